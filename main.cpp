@@ -4,13 +4,48 @@
 #include <vector>
 #include <string>
 #include <iostream>
-#include <algorithm> // Cho std::remove_if, std::random_shuffle, std::max
-#include <cstdlib>   // Cho rand(), srand()
+#include <algorithm> // Cho std::remove_if, std::max
+#include <cstdlib>   // Cho strtoul, malloc
 #include <ctime>     // Cho time()
 #include <limits>    // Cho std::numeric_limits
 #include <cctype>    // Cho std::tolower
 #include <cmath>     // Cho std::sqrt, std::round, std::abs
-#include <map>       // (Không dùng trong code cuối)
+#include <map>       // Cho std::map (bộ đệm bản đồ theo (màn, seed))
+#include <deque>     // Cho std::deque (thứ tự loại khỏi bộ đệm bản đồ)
+#include <bitset>    // Cho std::bitset::count (đếm ô trong bitboard)
+#include <chrono>    // Cho std::chrono::steady_clock (đo tốc độ chế độ headless)
+#include <cstring>   // Cho strcmp (tham số dòng lệnh)
+#include <climits>   // Cho INT_MAX
+#include <thread>    // Cho std::thread (giải mã tài nguyên song song)
+#include <atomic>    // Cho std::atomic
+#include <memory>    // Cho std::unique_ptr
+#include <mutex>     // Cho std::mutex (WorkerPool)
+#include <condition_variable>
+#include <future>    // Cho std::async (dựng màn kế tiếp trên luồng nền)
+#include <fstream>   // Cho std::ofstream (đóng gói tài nguyên)
+#include <cstdio>    // Cho vsnprintf/fwrite (luồng ghi log)
+#include <cstdarg>   // Cho va_list (logMessage)
+#include <type_traits> // Cho std::is_trivially_copyable (WorldSnapshot)
+#if defined(__SSE2__)
+#include <emmintrin.h> // SSE2 cho BulletPool::integrateSpan
+#endif
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI          // wingdi.h định nghĩa macro ERROR, trùng LogLevel::ERROR
+#include <winsock2.h>  // Socket UDP (phải đứng trước windows.h); liên kết ws2_32
+#include <ws2tcpip.h>
+#include <windows.h>   // CreateFileMapping/MapViewOfFile cho MappedFile
+#else
+#include <sys/mman.h>  // mmap cho MappedFile
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h> // Socket UDP cho chế độ mạng
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
 
 using namespace std; // Sử dụng không gian tên std
 
@@ -22,9 +57,15 @@ const int SCREEN_HEIGHT = 880; // Chiều cao cửa sổ game
 const int TILE_SIZE = 40;      // Kích thước mỗi ô vuông (tile) trên bản đồ
 const int MAP_WIDTH = SCREEN_WIDTH / TILE_SIZE;   // Chiều rộng bản đồ theo số ô (30)
 const int MAP_HEIGHT = SCREEN_HEIGHT / TILE_SIZE; // Chiều cao bản đồ theo số ô (22)
-const int PLAYER_SPEED = 2.5; // Tốc độ di chuyển của người chơi
-const int ENEMY_SPEED = 1.8;  // Tốc độ di chuyển của kẻ địch
+const float PLAYER_SPEED = 2.5f; // Tốc độ di chuyển của người chơi (px/tick)
+const float ENEMY_SPEED = 1.8f;  // Tốc độ di chuyển của kẻ địch (px/tick)
 const float UNIFIED_BULLET_SPEED = 6.0f; // Tốc độ chung cho đạn của người chơi và địch
+// Tọa độ fixed-point: 1 px = FP_ONE đơn vị con, để tốc độ lẻ (2.5, 1.8) không bị cắt thành số nguyên
+const int FP_SHIFT = 8;
+const int FP_ONE = 1 << FP_SHIFT;
+const int PLAYER_SPEED_FP = (int)(PLAYER_SPEED * FP_ONE + 0.5f);
+const int ENEMY_SPEED_FP = (int)(ENEMY_SPEED * FP_ONE + 0.5f);
+const int BULLET_SPEED_FP = (int)(UNIFIED_BULLET_SPEED * FP_ONE + 0.5f);
 const int PLAYER_SHOT_COOLDOWN_FRAMES = 28;
 //const int ORIGINAL_ENEMY_L1_MIN_DELAY_FOR_PLAYER_CALC = 85; // Tham số gốc để tính cooldown bắn của player
 //const int PLAYER_SHOT_COOLDOWN_FRAMES = static_cast<int>(round(ORIGINAL_ENEMY_L1_MIN_DELAY_FOR_PLAYER_CALC * 0.5)); // ~43 frames
@@ -36,26 +77,154 @@ const int DELAY_REDUCTION_PER_LEVEL_MIN = 9;
 const int DELAY_REDUCTION_PER_LEVEL_RANGE = 18;
 const int TOUGH_ENEMY_HP = 3; // Máu của loại xe tăng địch "trâu bò"
 const Uint32 ENEMY_HIT_FLASH_DURATION = 100; // Thời gian nhấp nháy của địch khi bị bắn (ms)
+const int TICKS_PER_SECOND = 60; // Số tick mô phỏng mỗi giây (thời gian trong game)
+const Uint32 TICK_DURATION_MS = 1000 / TICKS_PER_SECOND; // Thời lượng một tick mô phỏng (ms)
+const Uint32 ENEMY_SPAWN_DELAY = 2000; // Khoảng cách tối thiểu giữa hai lần sinh địch (ms thời gian game)
+const Uint32 ENEMY_HIT_FLASH_TICKS = ENEMY_HIT_FLASH_DURATION / TICK_DURATION_MS; // Mô phỏng đếm theo tick
+const Uint32 ENEMY_SPAWN_DELAY_TICKS = ENEMY_SPAWN_DELAY / TICK_DURATION_MS;
+const int AUDIO_FREQUENCY = 44100;  // Định dạng mở SDL_mixer, cũng là định dạng PCM trong gói tài nguyên
+const int AUDIO_CHANNELS = 2;
+const char* const ASSET_BUNDLE_PATH = "assets.bundle";
 
 // =============================================================================
 // == Enums (Các kiểu liệt kê) ==
 // =============================================================================
 enum class WallType { BRICK, STEEL, WATER, BUSH };
-enum class GameState { SELECT_MODE, PLAYING, GAME_OVER };
+enum class GameState { SELECT_MODE, PLAYING, LEVEL_TRANSITION, GAME_OVER };
 
 // =============================================================================
 // == Khai Báo Trước Các Lớp ==
 // =============================================================================
 class Wall;
-class Bullet;
+class TileGrid;
+class SpatialGrid;
+class BulletPool;
 class PlayerTank;
-class EnemyTank;
+class EnemyStore;
 class Game;
 
 // =============================================================================
 // == Khai Báo Trước Hàm Tiện Ích ==
 // =============================================================================
-SDL_Texture* loadTexture(const std::string &path, SDL_Renderer* renderer);
+inline int toFixed(int px) { return px * FP_ONE; }
+inline int fromFixed(int fp) { return fp >> FP_SHIFT; } // Dịch số học = làm tròn xuống
+// Nội suy giữa vị trí tick trước và tick hiện tại (alpha trong [0,1]), trả về pixel
+inline int lerpFixed(int prevFp, int curFp, float alpha) { return fromFixed(prevFp + (int)((curFp - prevFp) * alpha)); }
+
+// =============================================================================
+// == Ghi Log Bất Đồng Bộ (AsyncLogger) ==
+// =============================================================================
+// LOG_INFO/LOG_WARN/... chỉ định dạng thông điệp vào một ô của hàng đợi vòng không khóa (nhiều luồng
+// ghi, một luồng đọc, kiểu hàng đợi có số thứ tự trên từng ô). Một luồng nền lấy ra và ghi
+// stdout/stderr. Hàng đợi đầy thì thông điệp bị bỏ và được đếm, nên lời gọi log không bao giờ chờ
+// I/O hay khóa. LOG_RATE_LIMITED giới hạn tần suất theo từng nơi gọi, dùng cho thông điệp có thể lặp mỗi khung.
+enum class LogLevel { DEBUG, INFO, WARN, ERROR, OFF };
+const char* const LOG_LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+const int LOG_QUEUE_SLOTS = 1024; // Lũy thừa của 2
+const int LOG_MESSAGE_BYTES = 240;
+const int LOG_WRITER_IDLE_MS = 5;
+
+class AsyncLogger {
+public:
+    std::atomic<int> minLevel{(int)LogLevel::INFO};
+
+    static AsyncLogger& instance() { static AsyncLogger logger; return logger; }
+
+    void write(LogLevel level, const char* format, va_list args) {
+        if ((int)level < minLevel.load(std::memory_order_relaxed)) return;
+        Uint64 pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots[pos & (LOG_QUEUE_SLOTS - 1)];
+            Uint64 sequence = slot->sequence.load(std::memory_order_acquire);
+            Sint64 diff = (Sint64)(sequence - pos);
+            if (diff == 0) { if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break; }
+            else if (diff < 0) { dropped.fetch_add(1, std::memory_order_relaxed); return; } // Đầy
+            else pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+        slot->level = level;
+        vsnprintf(slot->text, sizeof(slot->text), format, args);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+private:
+    struct Slot { std::atomic<Uint64> sequence; LogLevel level; char text[LOG_MESSAGE_BYTES]; };
+    Slot slots[LOG_QUEUE_SLOTS];
+    std::atomic<Uint64> enqueuePos{0};
+    Uint64 dequeuePos = 0; // Chỉ luồng nền dùng
+    std::atomic<Uint64> dropped{0};
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+
+    AsyncLogger() {
+        for (int i = 0; i < LOG_QUEUE_SLOTS; ++i) slots[i].sequence.store((Uint64)i, std::memory_order_relaxed);
+        writer = std::thread([this]() { writerLoop(); });
+    }
+
+    ~AsyncLogger() { stopping.store(true, std::memory_order_release); writer.join(); } // Luồng nền ghi nốt trước khi thoát
+
+    bool writeOne() {
+        Slot& slot = slots[dequeuePos & (LOG_QUEUE_SLOTS - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) return false;
+        fprintf(slot.level >= LogLevel::WARN ? stderr : stdout, "[%s] %s\n", LOG_LEVEL_NAMES[(int)slot.level], slot.text);
+        slot.sequence.store(dequeuePos + LOG_QUEUE_SLOTS, std::memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+    void writerLoop() {
+        for (;;) {
+            bool stop = stopping.load(std::memory_order_acquire);
+            bool wrote = false;
+            while (writeOne()) wrote = true;
+            Uint64 lost = dropped.exchange(0, std::memory_order_relaxed);
+            if (lost) fprintf(stderr, "[WARN] Log queue full, %llu messages dropped\n", (unsigned long long)lost);
+            if (wrote || lost) { fflush(stdout); fflush(stderr); }
+            if (stop) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_WRITER_IDLE_MS));
+        }
+    }
+};
+
+void logMessage(LogLevel level, const char* format, ...)
+#if defined(__GNUC__) && !defined(_WIN32)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+void logMessage(LogLevel level, const char* format, ...) {
+    va_list args; va_start(args, format);
+    AsyncLogger::instance().write(level, format, args);
+    va_end(args);
+}
+
+// Cho qua tối đa một thông điệp mỗi intervalMs; số thông điệp bị nuốt được báo kèm lần kế tiếp
+class LogRateLimit {
+public:
+    bool allow(Uint32 intervalMs, Uint32& suppressedOut) {
+        Uint64 nowMs = (Uint64)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        Uint64 next = nextAllowedMs.load(std::memory_order_relaxed);
+        if (nowMs < next || !nextAllowedMs.compare_exchange_strong(next, nowMs + intervalMs, std::memory_order_relaxed)) {
+            suppressed.fetch_add(1, std::memory_order_relaxed); return false;
+        }
+        suppressedOut = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+private:
+    std::atomic<Uint64> nextAllowedMs{0};
+    std::atomic<Uint32> suppressed{0};
+};
+
+#define LOG_DEBUG(...) logMessage(LogLevel::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  logMessage(LogLevel::INFO, __VA_ARGS__)
+#define LOG_WARN(...)  logMessage(LogLevel::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) logMessage(LogLevel::ERROR, __VA_ARGS__)
+#define LOG_RATE_LIMITED(level, intervalMs, ...) do { \
+        static LogRateLimit logLimit_; Uint32 logSuppressed_ = 0; \
+        if (logLimit_.allow(intervalMs, logSuppressed_)) { \
+            logMessage(level, __VA_ARGS__); \
+            if (logSuppressed_) logMessage(level, "(%u similar messages suppressed)", logSuppressed_); \
+        } \
+    } while (0)
 
 // =============================================================================
 // == Lớp Wall (Tường) ==
@@ -72,68 +241,505 @@ public:
 };
 
 // =============================================================================
-// == Lớp Bullet (Đạn) ==
+// == Lớp TileGrid (Bitboard chiếm chỗ theo ô) ==
 // =============================================================================
-class Bullet {
+// Mỗi WallType một bitboard, mỗi hàng bản đồ một word (bit c = cột c).
+// Xe tăng 40x40 chỉ phủ tối đa 2x2 ô nên truy vấn va chạm địa hình chạm tối đa 4 ô,
+// thay vì quét toàn bộ vector<Wall>. Được dựng lại mỗi setupLevel và cập nhật khi gạch vỡ.
+static_assert(MAP_WIDTH <= 64, "TileGrid dùng một Uint64 cho mỗi hàng");
+
+class TileGrid {
 public:
-    float x, y;
-    float dx, dy;
-    SDL_Rect rect;
-    bool active;
-    float speed;
+    Uint64 rows[4][MAP_HEIGHT];              // [WallType][hàng]
+    Uint8 brickCount[MAP_HEIGHT][MAP_WIDTH]; // generateWalls có thể đặt chồng gạch lên cùng một ô
 
-    Bullet(float startX, float startY, int dirX, int dirY) :
-        x(startX), y(startY), dx(0.0f), dy(0.0f), rect({(int)startX, (int)startY, 8, 8}), active(true), speed(UNIFIED_BULLET_SPEED)
-    {
+    TileGrid() { clear(); }
+
+    void clear() { memset(rows, 0, sizeof(rows)); memset(brickCount, 0, sizeof(brickCount)); }
+
+    void build(const vector<Wall>& walls) {
+        clear();
+        for (const auto& w : walls) if (w.active) add(w);
+    }
+
+    void add(const Wall& w) {
+        int c = w.x / TILE_SIZE, r = w.y / TILE_SIZE;
+        if (!inBounds(c, r)) return;
+        rows[(int)w.type][r] |= bit(c);
+        if (w.type == WallType::BRICK) brickCount[r][c]++;
+    }
+
+    void removeBrick(const Wall& w) {
+        int c = w.x / TILE_SIZE, r = w.y / TILE_SIZE;
+        if (!inBounds(c, r) || brickCount[r][c] == 0) return;
+        if (--brickCount[r][c] == 0) rows[(int)WallType::BRICK][r] &= ~bit(c);
+    }
+
+    bool has(WallType type, int c, int r) const { return inBounds(c, r) && (rows[(int)type][r] & bit(c)); }
+
+    // Các ô chặn xe tăng (mọi loại trừ bụi cỏ)
+    Uint64 tankBlockingRow(int r) const {
+        return rows[(int)WallType::BRICK][r] | rows[(int)WallType::STEEL][r] | rows[(int)WallType::WATER][r];
+    }
+
+    // Tương đương quét walls với SDL_HasIntersection (chạm cạnh không tính là giao)
+    bool blocksTank(const SDL_Rect& rect) const {
+        if (rect.w <= 0 || rect.h <= 0 || rect.x + rect.w <= 0 || rect.y + rect.h <= 0) return false;
+        int c0 = max(0, rect.x) / TILE_SIZE, c1 = min(MAP_WIDTH - 1, (rect.x + rect.w - 1) / TILE_SIZE);
+        int r0 = max(0, rect.y) / TILE_SIZE, r1 = min(MAP_HEIGHT - 1, (rect.y + rect.h - 1) / TILE_SIZE);
+        if (c0 > c1 || r0 > r1) return false;
+        Uint64 mask = ((bit(c1) << 1) - 1) & ~(bit(c0) - 1);
+        for (int r = r0; r <= r1; ++r) if (tankBlockingRow(r) & mask) return true;
+        return false;
+    }
+
+    // Các ô chặn đạn (gạch, thép); đạn bay qua nước và bụi cỏ
+    Uint64 bulletBlockingRow(int r) const { return rows[(int)WallType::BRICK][r] | rows[(int)WallType::STEEL][r]; }
+
+    // Quét hộp box dịch đi (dx, dy) pixel qua lưới kiểu DDA: theo thứ tự thời gian, mỗi lần cạnh trước của hộp
+    // bước sang cột/hàng mới thì chỉ xét dải ô vừa bước vào, nên đạn nhanh đến đâu cũng không xuyên qua ô.
+    // Chạm: trả true, (hitC, hitR) là ô chặn đạn đầu tiên, tHit trong [0, 1] là lúc chạm (0: đã chồng sẵn).
+    bool sweepBullet(const SDL_Rect& box, int dx, int dy, int& hitC, int& hitR, float& tHit) const {
+        tHit = 0;
+        if (firstBulletBlocking(box, hitC, hitR)) return true;
+        int adx = std::abs(dx), ady = std::abs(dy);
+        // Cột/hàng kế tiếp cạnh trước sẽ bước vào, và quãng đường (px) phải đi hết trước khi chồng lên nó
+        int nextC = dx > 0 ? (box.x + box.w - 1) / TILE_SIZE + 1 : box.x / TILE_SIZE - 1;
+        int nextR = dy > 0 ? (box.y + box.h - 1) / TILE_SIZE + 1 : box.y / TILE_SIZE - 1;
+        int distC = dx > 0 ? nextC * TILE_SIZE - (box.x + box.w) : box.x - (nextC + 1) * TILE_SIZE;
+        int distR = dy > 0 ? nextR * TILE_SIZE - (box.y + box.h) : box.y - (nextR + 1) * TILE_SIZE;
+        for (;;) {
+            bool enterC = adx > distC && nextC >= 0 && nextC < MAP_WIDTH, enterR = ady > distR && nextR >= 0 && nextR < MAP_HEIGHT;
+            if (!enterC && !enterR) return false;
+            if (enterC && (!enterR || (long long)distC * ady <= (long long)distR * adx)) { // Tới ranh giới cột trước
+                int y = box.y + (int)((long long)dy * distC / adx); // Hộp lúc chạm ranh giới
+                int r0 = max(0, y / TILE_SIZE), r1 = min(MAP_HEIGHT - 1, (y + box.h - 1) / TILE_SIZE);
+                for (int r = r0; r <= r1; ++r)
+                    if (bulletBlockingRow(r) & bit(nextC)) { hitC = nextC; hitR = r; tHit = (float)distC / adx; return true; }
+                nextC += dx > 0 ? 1 : -1; distC += TILE_SIZE;
+            } else {
+                int x = box.x + (int)((long long)dx * distR / ady);
+                int c0 = max(0, x / TILE_SIZE), c1 = min(MAP_WIDTH - 1, (x + box.w - 1) / TILE_SIZE);
+                Uint64 hits = c0 <= c1 ? bulletBlockingRow(nextR) & ((bit(c1) << 1) - 1) & ~(bit(c0) - 1) : 0;
+                if (hits) { hitC = lowestBit(hits); hitR = nextR; tHit = (float)distR / ady; return true; }
+                nextR += dy > 0 ? 1 : -1; distR += TILE_SIZE;
+            }
+        }
+    }
+
+private:
+    static Uint64 bit(int c) { return (Uint64)1 << c; }
+    static int lowestBit(Uint64 v) { int c = 0; while (!(v & 1)) { v >>= 1; ++c; } return c; }
+
+    bool firstBulletBlocking(const SDL_Rect& box, int& hitC, int& hitR) const {
+        int c0 = max(0, box.x / TILE_SIZE), c1 = min(MAP_WIDTH - 1, (box.x + box.w - 1) / TILE_SIZE);
+        int r0 = max(0, box.y / TILE_SIZE), r1 = min(MAP_HEIGHT - 1, (box.y + box.h - 1) / TILE_SIZE);
+        if (box.w <= 0 || box.h <= 0 || c0 > c1 || r0 > r1) return false;
+        Uint64 mask = ((bit(c1) << 1) - 1) & ~(bit(c0) - 1);
+        for (int r = r0; r <= r1; ++r) if (Uint64 hits = bulletBlockingRow(r) & mask) { hitC = lowestBit(hits); hitR = r; return true; }
+        return false;
+    }
+    static bool inBounds(int c, int r) { return c >= 0 && c < MAP_WIDTH && r >= 0 && r < MAP_HEIGHT; }
+};
+
+// =============================================================================
+// == Lớp FlowField (Trường hướng đi BFS tới một người chơi) ==
+// =============================================================================
+// Khoảng cách (số ô) từ mọi ô xe tăng đi được tới ô của người chơi, cùng hướng đi tiếp theo của
+// mỗi ô. Mỗi người chơi một trường, dùng chung cho mọi xe tăng địch: quyết định đi đâu chỉ là
+// một lần tra bảng. Tính lại toàn bộ khi người chơi sang ô khác; khi gạch vỡ chỉ lan phần
+// khoảng cách bị rút ngắn (gỡ vật cản không bao giờ làm đường đi dài ra).
+const int FLOW_DX[4] = {0, 0, -1, 1}; // Lên, xuống, trái, phải
+const int FLOW_DY[4] = {-1, 1, 0, 0};
+
+class FlowField {
+public:
+    static constexpr Uint16 UNREACHABLE = 0xFFFF;
+
+    void invalidate() { valid = false; }
+
+    // Tính lại nếu mục tiêu đổi ô (hoặc trường chưa hợp lệ)
+    void retarget(const TileGrid& terrain, int c, int r) {
+        if (valid && c == goalC && r == goalR) return;
+        goalC = c; goalR = r; valid = true;
+        for (auto& row : dist) for (auto& d : row) d = UNREACHABLE;
+        int head = 0, tail = 0;
+        if (passable(terrain, c, r)) { dist[r][c] = 0; queue[tail++] = r * MAP_WIDTH + c; }
+        while (head < tail) relaxNeighbours(terrain, queue[head++], tail);
+        for (int row = 0; row < MAP_HEIGHT; ++row) for (int col = 0; col < MAP_WIDTH; ++col) updateNext(col, row);
+    }
+
+    // Ô (c,r) vừa hết gạch: khoảng cách chỉ có thể giảm, lan từ ô này qua các ô được rút ngắn
+    void openTile(const TileGrid& terrain, int c, int r) {
+        if (!valid || !passable(terrain, c, r) || dist[r][c] != UNREACHABLE) return;
+        Uint16 best = UNREACHABLE;
+        for (int d = 0; d < 4; ++d) if (inInterior(c + FLOW_DX[d], r + FLOW_DY[d])) best = min(best, dist[r + FLOW_DY[d]][c + FLOW_DX[d]]);
+        if (best == UNREACHABLE) return; // Vẫn bị cô lập khỏi mục tiêu
+        dist[r][c] = best + 1;
+        int head = 0, tail = 0; queue[tail++] = r * MAP_WIDTH + c;
+        while (head < tail) relaxNeighbours(terrain, queue[head++], tail);
+        for (int k = 0; k < tail; ++k) { // Hướng đi chỉ đổi ở ô đã giảm và hàng xóm của chúng
+            int col = queue[k] % MAP_WIDTH, row = queue[k] / MAP_WIDTH;
+            updateNext(col, row);
+            for (int d = 0; d < 4; ++d) updateNext(col + FLOW_DX[d], row + FLOW_DY[d]);
+        }
+    }
+
+    Uint16 distance(int c, int r) const { return (valid && inInterior(c, r)) ? dist[r][c] : UNREACHABLE; }
+    // Chỉ số trong FLOW_DX/FLOW_DY, -1 nếu đã tới đích hoặc không có đường
+    int nextDir(int c, int r) const { return (valid && inInterior(c, r)) ? next[r][c] : -1; }
+
+private:
+    Uint16 dist[MAP_HEIGHT][MAP_WIDTH];
+    Sint8 next[MAP_HEIGHT][MAP_WIDTH];
+    int queue[MAP_WIDTH * MAP_HEIGHT];
+    int goalC = -1, goalR = -1;
+    bool valid = false;
+
+    // Xe tăng bị giữ cách mép màn hình một ô nên chỉ các ô bên trong là đi được
+    static bool inInterior(int c, int r) { return c >= 1 && c < MAP_WIDTH - 1 && r >= 1 && r < MAP_HEIGHT - 1; }
+    static bool passable(const TileGrid& terrain, int c, int r) { return inInterior(c, r) && !((terrain.tankBlockingRow(r) >> c) & 1); }
+
+    void relaxNeighbours(const TileGrid& terrain, int cell, int& tail) {
+        int c = cell % MAP_WIDTH, r = cell / MAP_WIDTH;
+        Uint16 nd = dist[r][c] + 1;
+        for (int d = 0; d < 4; ++d) {
+            int nc = c + FLOW_DX[d], nr = r + FLOW_DY[d];
+            if (passable(terrain, nc, nr) && dist[nr][nc] > nd) { dist[nr][nc] = nd; queue[tail++] = nr * MAP_WIDTH + nc; }
+        }
+    }
+
+    void updateNext(int c, int r) {
+        if (!inInterior(c, r)) return;
+        next[r][c] = -1;
+        Uint16 d0 = dist[r][c];
+        if (d0 == UNREACHABLE || d0 == 0) return;
+        for (int d = 0; d < 4; ++d) {
+            int nc = c + FLOW_DX[d], nr = r + FLOW_DY[d];
+            if (inInterior(nc, nr) && dist[nr][nc] == d0 - 1) { next[r][c] = (Sint8)d; return; }
+        }
+    }
+};
+
+// =============================================================================
+// == Lớp SpatialGrid (Broadphase cho vật thể động) ==
+// =============================================================================
+// Lưới đều chia màn hình thành ô CELL_SIZE, dựng lại mỗi tick: insert() rồi finish()
+// sắp các id theo ô (counting sort vào mảng phẳng, không cấp phát sau khi đã "ấm").
+// Truy vấn chỉ duyệt các id nằm trong những ô mà hình chữ nhật chạm tới.
+class SpatialGrid {
+public:
+    static constexpr int CELL_SIZE = TILE_SIZE * 2;
+    static constexpr int COLS = (SCREEN_WIDTH + CELL_SIZE - 1) / CELL_SIZE;
+    static constexpr int ROWS = (SCREEN_HEIGHT + CELL_SIZE - 1) / CELL_SIZE;
+
+    void clear() { pending.clear(); }
+
+    // Dự trữ cho tối đa objects vật thể không lớn hơn một ô (mỗi vật chạm tối đa 2x2 ô)
+    void reserve(int objects) { pending.reserve(objects * 4); items.reserve(objects * 4); }
+
+    void insert(int id, const SDL_Rect& r) { forEachCell(r, [&](int cell) { pending.push_back({cell, id}); }); }
+
+    void finish() {
+        memset(cellStart, 0, sizeof(cellStart));
+        for (const auto& e : pending) cellStart[e.cell + 1]++;
+        for (int c = 0; c < COLS * ROWS; ++c) cellStart[c + 1] += cellStart[c];
+        items.resize(pending.size());
+        int fill[COLS * ROWS]; memcpy(fill, cellStart, sizeof(fill));
+        for (const auto& e : pending) items[fill[e.cell]++] = e.id;
+    }
+
+    // Trả về id nhỏ nhất thỏa pred trong các ô mà r chạm tới (-1 nếu không có).
+    // Chọn id nhỏ nhất để giữ đúng thứ tự "gặp đầu tiên" như vòng lặp tuyến tính cũ.
+    template <class Pred> int firstMatch(const SDL_Rect& r, Pred pred) const {
+        int best = -1;
+        forEachCell(r, [&](int cell) {
+            for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+                int id = items[k];
+                if ((best < 0 || id < best) && pred(id)) best = id;
+            }
+        });
+        return best;
+    }
+
+    // Gọi fn(id) cho mọi id trong các ô r chạm tới (một id có thể được gọi nhiều lần nếu nằm ở nhiều ô)
+    template <class F> void query(const SDL_Rect& r, F fn) const {
+        forEachCell(r, [&](int cell) { for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k) fn(items[k]); });
+    }
+
+private:
+    struct Entry { int cell, id; };
+    vector<Entry> pending;
+    vector<int> items;
+    int cellStart[COLS * ROWS + 1] = {};
+
+    template <class F> static void forEachCell(const SDL_Rect& r, F fn) {
+        if (r.w <= 0 || r.h <= 0) return;
+        int c0 = max(0, r.x / CELL_SIZE), c1 = min(COLS - 1, (r.x + r.w - 1) / CELL_SIZE);
+        int r0 = max(0, r.y / CELL_SIZE), r1 = min(ROWS - 1, (r.y + r.h - 1) / CELL_SIZE);
+        for (int row = r0; row <= r1; ++row)
+            for (int col = c0; col <= c1; ++col) fn(row * COLS + col);
+    }
+};
+
+// Vị trí xe tăng địch trong lưới được nới thêm biên này (px), đủ cho một tick di chuyển,
+// nên lưới dựng đầu tick vẫn đúng khi các xe tăng đã di chuyển trong cùng tick
+const int ENEMY_GRID_MARGIN = 4;
+const int ENEMY_STORE_CAPACITY = 64; // Dự trữ sẵn cho kho xe địch và broadphase: tick giữa màn không cấp phát
+
+// =============================================================================
+// == Lớp BulletPool (Kho đạn chung, dạng structure-of-arrays) ==
+// =============================================================================
+// Mọi viên đạn của mọi xe tăng nằm trong một kho duy nhất, mỗi thuộc tính một mảng liên tục.
+// Đạn chết được xóa bằng cách đổi chỗ với phần tử cuối (swap-remove), dung lượng được giữ lại
+// nên bắn đạn không cấp phát bộ nhớ. integrate() di chuyển 4 viên một lần bằng SSE2, phần dư (hoặc khi
+// không có SSE2) chạy vòng lặp vô hướng tương đương. Va chạm và biên do Game quét trên đoạn prev -> hiện tại.
+const int OWNER_PLAYER1 = 0;
+const int OWNER_PLAYER2 = 1;
+const int OWNER_ENEMY_BASE = 2; // Chủ của đạn địch = OWNER_ENEMY_BASE + EnemyCold::id
+const int BULLET_SIZE = 8;
+const int BULLET_POOL_INITIAL_CAPACITY = 256;
+
+class BulletPool {
+public:
+    vector<int> fx, fy;         // Tâm viên đạn (fixed-point)
+    vector<int> prevFx, prevFy; // Tâm ở tick trước, dùng để nội suy khi vẽ
+    vector<int> dx, dy;         // Vận tốc (fixed-point/tick)
+    vector<int> owner;
+    vector<int> alive;          // 1 = còn bay, 0 = chờ dọn (int để cùng độ rộng với các mảng khác khi vector hóa)
+    int count = 0;
+
+    BulletPool() { reserve(BULLET_POOL_INITIAL_CAPACITY); }
+
+    void clear() { count = 0; }
+
+    void spawn(float startX, float startY, int dirX, int dirY, int ownerId) {
+        if (count == (int)fx.size()) reserve(count * 2); // Chỉ xảy ra khi vượt mức đã dự trữ
+        int i = count++;
+        fx[i] = (int)lround(startX * FP_ONE); fy[i] = (int)lround(startY * FP_ONE);
+        prevFx[i] = fx[i]; prevFy[i] = fy[i];
         float length = sqrt(static_cast<float>(dirX * dirX + dirY * dirY));
         if (length > 0) {
-            dx = (dirX / length) * speed;
-            dy = (dirY / length) * speed;
+            dx[i] = (int)lround((dirX / length) * BULLET_SPEED_FP);
+            dy[i] = (int)lround((dirY / length) * BULLET_SPEED_FP);
         } else {
-            dx = 0; dy = -speed; // Mặc định bắn lên
+            dx[i] = 0; dy[i] = -BULLET_SPEED_FP; // Mặc định bắn lên
         }
-        rect.x = (int)(x - rect.w / 2.0f);
-        rect.y = (int)(y - rect.h / 2.0f);
+        owner[i] = ownerId; alive[i] = 1;
     }
 
-    void move() {
-        if (!active) return;
-        x += dx; y += dy;
-        rect.x = (int)(x - rect.w / 2.0f);
-        rect.y = (int)(y - rect.h / 2.0f);
-        if (rect.x < TILE_SIZE || rect.x + rect.w > SCREEN_WIDTH - TILE_SIZE ||
-            rect.y < TILE_SIZE || rect.y + rect.h > SCREEN_HEIGHT - TILE_SIZE) {
-            active = false;
+    // Di chuyển tất cả đạn một tick (vị trí cũ giữ trong prevFx/prevFy làm điểm đầu của đoạn quét va chạm)
+    void integrate() { integrateSpan(count, fx.data(), fy.data(), prevFx.data(), prevFy.data(), dx.data(), dy.data()); }
+
+    // Thêm nguyên trạng một viên đạn (khôi phục ảnh chụp)
+    void restore(int fxValue, int fyValue, int prevFxValue, int prevFyValue, int dxValue, int dyValue, int ownerId) {
+        if (count == (int)fx.size()) reserve(count * 2);
+        int i = count++;
+        fx[i] = fxValue; fy[i] = fyValue; prevFx[i] = prevFxValue; prevFy[i] = prevFyValue;
+        dx[i] = dxValue; dy[i] = dyValue; owner[i] = ownerId; alive[i] = 1;
+    }
+
+    void killOwner(int ownerId) { for (int i = 0; i < count; ++i) if (owner[i] == ownerId) alive[i] = 0; }
+
+    // Dọn các viên đã chết (thứ tự không được giữ)
+    void compact() {
+        for (int i = 0; i < count; ) {
+            if (alive[i]) { ++i; continue; }
+            int last = --count;
+            fx[i] = fx[last]; fy[i] = fy[last]; prevFx[i] = prevFx[last]; prevFy[i] = prevFy[last];
+            dx[i] = dx[last]; dy[i] = dy[last]; owner[i] = owner[last]; alive[i] = alive[last];
+        }
+    }
+
+    SDL_Rect rect(int i) const { return { fromFixed(fx[i]) - BULLET_SIZE / 2, fromFixed(fy[i]) - BULLET_SIZE / 2, BULLET_SIZE, BULLET_SIZE }; }
+    SDL_Rect prevRect(int i) const { return { fromFixed(prevFx[i]) - BULLET_SIZE / 2, fromFixed(prevFy[i]) - BULLET_SIZE / 2, BULLET_SIZE, BULLET_SIZE }; }
+
+    // Đạn đã ra khỏi vùng chơi (đè lên viền một ô quanh màn hình)
+    static bool outsidePlayfield(const SDL_Rect& r) {
+        return r.x < TILE_SIZE || r.x + r.w > SCREEN_WIDTH - TILE_SIZE || r.y < TILE_SIZE || r.y + r.h > SCREEN_HEIGHT - TILE_SIZE;
+    }
+
+    SDL_Rect renderRect(int i, float alpha) const {
+        return { lerpFixed(prevFx[i], fx[i], alpha) - BULLET_SIZE / 2, lerpFixed(prevFy[i], fy[i], alpha) - BULLET_SIZE / 2, BULLET_SIZE, BULLET_SIZE };
+    }
+
+private:
+    static void integrateSpan(int n, int* __restrict px, int* __restrict py, int* __restrict ppx, int* __restrict ppy,
+                              const int* __restrict vx, const int* __restrict vy) {
+        int i = 0;
+#if defined(__SSE2__)
+        for (; i + 4 <= n; i += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(px + i)), y = _mm_loadu_si128((const __m128i*)(py + i));
+            _mm_storeu_si128((__m128i*)(ppx + i), x); _mm_storeu_si128((__m128i*)(ppy + i), y);
+            x = _mm_add_epi32(x, _mm_loadu_si128((const __m128i*)(vx + i)));
+            y = _mm_add_epi32(y, _mm_loadu_si128((const __m128i*)(vy + i)));
+            _mm_storeu_si128((__m128i*)(px + i), x); _mm_storeu_si128((__m128i*)(py + i), y);
         }
+#endif
+        for (; i < n; ++i) {
+            ppx[i] = px[i]; ppy[i] = py[i];
+            px[i] += vx[i]; py[i] += vy[i];
+        }
+    }
+
+    void reserve(int capacity) {
+        for (vector<int>* a : { &fx, &fy, &prevFx, &prevFy, &dx, &dy, &owner, &alive }) a->resize(capacity);
     }
 };
 
+// Lúc (trong [0, 1]) hộp box dịch đi (dx, dy) bắt đầu giao thực sự với target (chạm cạnh không tính,
+// như SDL_HasIntersection); -1 nếu cả đoạn không giao. Dùng cho đạn trúng xe tăng (xe coi như đứng yên).
+inline float sweptEntry(const SDL_Rect& box, int dx, int dy, const SDL_Rect& target) {
+    float enter = 0, exit = 1;
+    auto axis = [&](int lo, int size, int d, int targetLo, int targetSize) {
+        if (d == 0) { if (lo >= targetLo + targetSize || lo + size <= targetLo) exit = -1; return; }
+        float t0 = (float)(targetLo - (lo + size)) / d, t1 = (float)(targetLo + targetSize - lo) / d;
+        if (t0 > t1) std::swap(t0, t1);
+        enter = max(enter, t0); exit = min(exit, t1);
+    };
+    axis(box.x, box.w, dx, target.x, target.w);
+    axis(box.y, box.h, dy, target.y, target.h);
+    return enter < exit ? enter : -1.0f;
+}
+
 // =============================================================================
-// == Lớp PlayerTank (Xe Tăng Người Chơi) ==
+// == Lớp SightLines (Tầm bắn theo hàng/cột) ==
 // =============================================================================
-class PlayerTank {
+// Mỗi ô ghi khoảng ô liền nhau không chặn đạn (không gạch, không thép) chứa nó, theo hàng và theo cột.
+// "Đạn từ ô a bay tới ô b trên cùng hàng/cột được không" là hai phép so sánh, đủ rẻ để mọi xe địch
+// hỏi mỗi tick. Gạch vỡ chỉ dựng lại đúng hàng và cột của ô đó.
+class SightLines {
 public:
-    int x, y;
-    int velocityX, velocityY;
+    SightLines() { build(TileGrid()); }
+
+    void build(const TileGrid& terrain) {
+        for (int r = 0; r < MAP_HEIGHT; ++r) rebuildRow(terrain, r);
+        for (int c = 0; c < MAP_WIDTH; ++c) rebuildColumn(terrain, c);
+    }
+
+    // Ô (c,r) vừa mất một viên gạch (có thể vẫn còn gạch chồng bên dưới)
+    void openTile(const TileGrid& terrain, int c, int r) {
+        if (c < 0 || c >= MAP_WIDTH || r < 0 || r >= MAP_HEIGHT || (terrain.bulletBlockingRow(r) >> c & 1)) return;
+        rebuildRow(terrain, r); rebuildColumn(terrain, c);
+    }
+
+    bool clearRow(int r, int c0, int c1) const { return c1 >= rowLo[r][c0] && c1 <= rowHi[r][c0]; }
+    bool clearColumn(int c, int r0, int r1) const { return r1 >= colLo[r0][c] && r1 <= colHi[r0][c]; }
+
+    // Đạn bắn từ tâm (x, y) theo chiều ngang (horizontal) hoặc dọc có tới được hàng/cột chứa (targetX, targetY)
+    // mà không chạm gạch/thép. Hộp đạn BULLET_SIZE có thể nằm vắt qua hai hàng/cột nên xét cả hai.
+    bool clearShot(int x, int y, int targetX, int targetY, bool horizontal) const {
+        if (!inMap(x, y) || !inMap(targetX, targetY)) return false;
+        if (horizontal) {
+            int c0 = x / TILE_SIZE, c1 = targetX / TILE_SIZE;
+            for (int r = max(0, y - BULLET_SIZE / 2) / TILE_SIZE; r <= min(SCREEN_HEIGHT - 1, y + BULLET_SIZE / 2 - 1) / TILE_SIZE; ++r)
+                if (!clearRow(r, c0, c1)) return false;
+        } else {
+            int r0 = y / TILE_SIZE, r1 = targetY / TILE_SIZE;
+            for (int c = max(0, x - BULLET_SIZE / 2) / TILE_SIZE; c <= min(SCREEN_WIDTH - 1, x + BULLET_SIZE / 2 - 1) / TILE_SIZE; ++c)
+                if (!clearColumn(c, r0, r1)) return false;
+        }
+        return true;
+    }
+
+private:
+    // Ô chặn đạn có lo > hi nên không khoảng nào chứa được nó
+    Uint8 rowLo[MAP_HEIGHT][MAP_WIDTH], rowHi[MAP_HEIGHT][MAP_WIDTH];
+    Uint8 colLo[MAP_HEIGHT][MAP_WIDTH], colHi[MAP_HEIGHT][MAP_WIDTH];
+
+    static bool inMap(int x, int y) { return x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT; }
+
+    void rebuildRow(const TileGrid& terrain, int r) {
+        Uint64 blocked = terrain.bulletBlockingRow(r);
+        for (int c = 0; c < MAP_WIDTH;) {
+            if (blocked >> c & 1) { rowLo[r][c] = 1; rowHi[r][c] = 0; ++c; continue; }
+            int end = c; while (end + 1 < MAP_WIDTH && !(blocked >> (end + 1) & 1)) ++end;
+            for (int k = c; k <= end; ++k) { rowLo[r][k] = (Uint8)c; rowHi[r][k] = (Uint8)end; }
+            c = end + 1;
+        }
+    }
+
+    void rebuildColumn(const TileGrid& terrain, int c) {
+        auto blocked = [&](int r) { return (terrain.bulletBlockingRow(r) >> c & 1) != 0; };
+        for (int r = 0; r < MAP_HEIGHT;) {
+            if (blocked(r)) { colLo[r][c] = 1; colHi[r][c] = 0; ++r; continue; }
+            int end = r; while (end + 1 < MAP_HEIGHT && !blocked(end + 1)) ++end;
+            for (int k = r; k <= end; ++k) { colLo[k][c] = (Uint8)r; colHi[k][c] = (Uint8)end; }
+            r = end + 1;
+        }
+    }
+};
+
+// =============================================================================
+// == Lớp TankBody (Phần chung của xe tăng người chơi và địch) ==
+// =============================================================================
+// Vị trí, vận tốc, hướng và rect: cùng một cách tích phân từng trục có chặn và cùng điểm sinh đạn.
+struct TankBody {
+    int x, y;                 // Vị trí pixel (= fromFixed(fx/fy)), dùng cho va chạm
+    int fx, fy;               // Vị trí sub-pixel (fixed-point)
+    int prevFx, prevFy;       // Vị trí ở tick trước, dùng để nội suy khi vẽ
+    int velocityX, velocityY; // Fixed-point/tick
     int lastDirX, lastDirY;
     SDL_Rect rect;
-    vector<Bullet> bullets;
+
+    TankBody(int startX = 0, int startY = 0, int dirX = 0, int dirY = -1) :
+        x(startX), y(startY), fx(toFixed(startX)), fy(toFixed(startY)), prevFx(fx), prevFy(fy),
+        velocityX(0), velocityY(0), lastDirX(dirX), lastDirY(dirY), rect({startX, startY, TILE_SIZE, TILE_SIZE}) {}
+
+    void placeAt(int px, int py) { x = px; y = py; fx = toFixed(x); fy = toFixed(y); prevFx = fx; prevFy = fy; rect = {x, y, TILE_SIZE, TILE_SIZE}; }
+
+    SDL_Rect renderRect(float alpha) const { return { lerpFixed(prevFx, fx, alpha), lerpFixed(prevFy, fy, alpha), rect.w, rect.h }; }
+
+    // Đi trục X rồi trục Y; trục nào mà blocked() (đọc rect) báo chạm thì trả về chỗ cũ, không thì chặn trong biên
+    template <class Blocked> void integrate(Blocked blocked) {
+        prevFx = fx; prevFy = fy;
+        if (velocityX == 0 && velocityY == 0) return;
+
+        fx += velocityX; x = fromFixed(fx); rect.x = x;
+        if (blocked()) { fx = prevFx; x = fromFixed(fx); rect.x = x; }
+        else { // Kiểm tra biên X sau tường
+            if (x < TILE_SIZE) { x = TILE_SIZE; fx = toFixed(x); }
+            else if (x + rect.w > SCREEN_WIDTH - TILE_SIZE) { x = SCREEN_WIDTH - TILE_SIZE - rect.w; fx = toFixed(x); }
+            rect.x = x;
+        }
+
+        fy += velocityY; y = fromFixed(fy); rect.y = y;
+        if (blocked()) { fy = prevFy; y = fromFixed(fy); rect.y = y; }
+        else { // Kiểm tra biên Y sau tường
+            if (y < TILE_SIZE) { y = TILE_SIZE; fy = toFixed(y); }
+            else if (y + rect.h > SCREEN_HEIGHT - TILE_SIZE) { y = SCREEN_HEIGHT - TILE_SIZE - rect.h; fy = toFixed(y); }
+            rect.y = y;
+        }
+    }
+
+    // Đạn xuất phát ngay trước nòng theo hướng nhìn
+    void fireBullet(BulletPool& bullets, int ownerId) const {
+        float bulletStartX = rect.x + TILE_SIZE / 2.0f;
+        float bulletStartY = rect.y + TILE_SIZE / 2.0f;
+        if (lastDirX > 0) bulletStartX += TILE_SIZE / 2.0f + 1; else if (lastDirX < 0) bulletStartX -= TILE_SIZE / 2.0f + 1;
+        if (lastDirY > 0) bulletStartY += TILE_SIZE / 2.0f + 1; else if (lastDirY < 0) bulletStartY -= TILE_SIZE / 2.0f + 1;
+        bullets.spawn(bulletStartX, bulletStartY, lastDirX, lastDirY, ownerId);
+    }
+};
+
+// =============================================================================
+// == Lớp PlayerTank (Xe Tăng Người Chơi) ==
+// =============================================================================
+class PlayerTank : public TankBody {
+public:
     int shotDelayCounter;
     bool isActive = true; // Dùng isActive thay vì active để phân biệt với các lớp khác
 
-    PlayerTank(int startX = 0, int startY = 0) :
-        x(startX), y(startY), velocityX(0), velocityY(0), lastDirX(0), lastDirY(-1),
-        rect({startX, startY, TILE_SIZE, TILE_SIZE}), shotDelayCounter(0), isActive(true) {}
+    PlayerTank(int startX = 0, int startY = 0) : TankBody(startX, startY), shotDelayCounter(0), isActive(true) {}
 
     void reset(int startX, int startY) {
-        x = startX; y = startY; rect.x = x; rect.y = y;
+        placeAt(startX, startY);
         velocityX = 0; velocityY = 0; lastDirX = 0; lastDirY = -1;
-        bullets.clear(); shotDelayCounter = 0; isActive = true;
+        shotDelayCounter = 0; isActive = true;
     }
 
     void hitByEnemy() {
         if (!isActive) return;
-        cout << "Player hit!" << endl;
         isActive = false;
         // Trong game thực tế, bạn có thể giảm mạng hoặc bắt đầu hồi sinh ở đây
     }
@@ -142,156 +748,204 @@ public:
         if (shotDelayCounter > 0) shotDelayCounter--;
     }
 
-    void updatePosition(const vector<Wall>& walls, const vector<EnemyTank>& enemies); // Định nghĩa sau EnemyTank
+    void updatePosition(const TileGrid& terrain, const EnemyStore& enemies, const SpatialGrid& enemyGrid); // Định nghĩa sau EnemyStore
 
-    bool shoot() {
+    bool shoot(BulletPool& bullets, int ownerId) {
         if (!isActive || shotDelayCounter > 0 || (lastDirX == 0 && lastDirY == 0)) return false;
-        float bulletStartX = rect.x + TILE_SIZE / 2.0f;
-        float bulletStartY = rect.y + TILE_SIZE / 2.0f;
-        if (lastDirX > 0) bulletStartX += TILE_SIZE / 2.0f + 1; else if (lastDirX < 0) bulletStartX -= TILE_SIZE / 2.0f + 1;
-        if (lastDirY > 0) bulletStartY += TILE_SIZE / 2.0f + 1; else if (lastDirY < 0) bulletStartY -= TILE_SIZE / 2.0f + 1;
-        bullets.push_back(Bullet(bulletStartX, bulletStartY, lastDirX, lastDirY));
+        fireBullet(bullets, ownerId);
         shotDelayCounter = PLAYER_SHOT_COOLDOWN_FRAMES;
         return true;
     }
-
-    void updateBullets() {
-        if (!isActive) { bullets.clear(); return; }
-        for (auto &b : bullets) if (b.active) b.move();
-        bullets.erase(remove_if(bullets.begin(), bullets.end(), [](const Bullet &b){ return !b.active; }), bullets.end());
-    }
 };
 
 
 // =============================================================================
-// == Lớp EnemyTank (Xe Tăng Địch) - CÓ AI CẢI TIẾN ==
+// == Lớp EnemyStore (Xe Tăng Địch: slot map + AI) ==
 // =============================================================================
-class EnemyTank {
-public:
-    int x, y;
-    int velocityX, velocityY;
-    int lastDirX, lastDirY;
-    SDL_Rect rect;
-    bool active; // Dùng active cho địch
-    vector<Bullet> bullets;
-    int moveDecisionDelay;
-    int shootDelay;
-    int level;
-    int hitPoints;
-    int initialHitPoints;
+// Xe địch nằm dày đặc theo chỉ số 0..size()-1 trong hai mảng song song: hot (vị trí, vận tốc, máu,
+// còn sống) được broadphase, va chạm, vẽ và quan sát duyệt mỗi tick; cold (bộ đếm AI, RNG, hiệu ứng
+// trúng đạn) chỉ pha AI và ảnh chụp đụng tới. Xóa là đổi chỗ với phần tử cuối (O(1)), nên chỉ số dày
+// đặc chỉ ổn định trong một tick; muốn giữ tham chiếu qua nhiều tick thì dùng EnemyHandle (ô trong
+// bảng slot + thế hệ), find() trả -1 khi xe đã bị xóa dù ô đã được dùng lại. Xe mới luôn lấy slot trống
+// nhỏ nhất, nên cách xếp slot chỉ phụ thuộc tập xe đang sống: ảnh chụp ghi xe theo slot (bản ghi của
+// một xe không dời chỗ khi xe khác bị xóa) và khôi phục đúng cách xếp đó bằng spawnInSlot().
+struct EnemyHandle { Uint32 slot = ~0u, generation = 0; };
+
+struct EnemyHot : TankBody {
+    int hitPoints = 1;
+    bool active = true;
+};
+
+struct EnemyCold {
+    int id = -1;              // Định danh duy nhất trong màn, dùng làm chủ sở hữu đạn
+    int level = 1;
+    int initialHitPoints = 1;
+    int moveDecisionDelay = 0;
+    int flowDetourTicks = 0;  // > 0: đường theo trường hướng đang bị chặn, đi lang thang trước khi thử lại
+    int shootDelay = 0;
     bool isHit = false;
-    Uint32 hitStartTime = 0;
-    Mix_Chunk* shootSound = nullptr;
-    Mix_Chunk* destroySound = nullptr;
-
-    EnemyTank(int startX, int startY, int current_level, int initialHP = 1, Mix_Chunk* s_sound = nullptr, Mix_Chunk* d_sound = nullptr) :
-        x(startX), y(startY), velocityX(0), velocityY(ENEMY_SPEED), lastDirX(0), lastDirY(1),
-        rect({startX, startY, TILE_SIZE, TILE_SIZE}), active(true),
-        moveDecisionDelay(40 + rand() % 80), level(current_level), hitPoints(initialHP),
-        initialHitPoints(initialHP), shootSound(s_sound), destroySound(d_sound)
-    {
-        resetShootCooldown();
+    bool wantsToShoot = false; // Quyết định của pha AI, pha áp dụng mới thực sự bắn
+    Uint32 hitStartTick = 0;
+    Uint32 rngState = 1;      // RNG riêng (xorshift32): pha AI chạy song song không đụng RNG của Game
+};
+
+class EnemyStore {
+public:
+    vector<EnemyHot> hot;   // Cùng chỉ số với cold
+    vector<EnemyCold> cold;
+
+    int size() const { return (int)hot.size(); }
+    bool empty() const { return hot.empty(); }
+
+    void reserve(int capacity) { hot.reserve(capacity); cold.reserve(capacity); denseSlot.reserve(capacity); slots.reserve(capacity); freeSlots.reserve(capacity); }
+
+    // Xóa hết nhưng giữ bảng slot (tăng thế hệ) để handle cũ không trỏ nhầm sang xe mới
+    void clear() {
+        for (Uint32 s : denseSlot) { slots[s].generation++; freeSlots.push_back(s); }
+        hot.clear(); cold.clear(); denseSlot.clear();
+    }
+
+    // seed: lấy từ RNG của Game lúc sinh (tuần tự) nên vẫn tất định theo seed của trận
+    EnemyHandle spawn(int startX, int startY, int level, Uint32 seed, int initialHP = 1) {
+        Uint32 s;
+        if (!freeSlots.empty()) { auto lowest = std::min_element(freeSlots.begin(), freeSlots.end()); s = *lowest; *lowest = freeSlots.back(); freeSlots.pop_back(); }
+        else { s = (Uint32)slots.size(); slots.push_back(Slot()); }
+        return place(s, startX, startY, level, seed, initialHP);
+    }
+
+    // Sinh xe vào đúng slot s đang trống (khôi phục ảnh chụp)
+    EnemyHandle spawnInSlot(Uint32 s, int startX, int startY, int level, Uint32 seed, int initialHP = 1) {
+        while (slots.size() <= s) { freeSlots.push_back((Uint32)slots.size()); slots.push_back(Slot()); }
+        auto it = std::find(freeSlots.begin(), freeSlots.end(), s);
+        if (it == freeSlots.end()) return EnemyHandle(); // Slot đang có xe: ảnh chụp hỏng
+        *it = freeSlots.back(); freeSlots.pop_back();
+        return place(s, startX, startY, level, seed, initialHP);
     }
 
-    void resetShootCooldown() {
+    EnemyHandle handle(int i) const { Uint32 s = denseSlot[i]; return {s, slots[s].generation}; }
+    int find(EnemyHandle h) const { return (h.slot < slots.size() && slots[h.slot].generation == h.generation) ? (int)slots[h.slot].dense : -1; }
+    int slotCount() const { return (int)slots.size(); } // Mọi slot < slotCount()
+
+    void removeAt(int i) {
+        Uint32 s = denseSlot[i];
+        slots[s].generation++; freeSlots.push_back(s);
+        int last = size() - 1;
+        if (i != last) { hot[i] = hot[last]; cold[i] = cold[last]; denseSlot[i] = denseSlot[last]; slots[denseSlot[i]].dense = (Uint32)i; }
+        hot.pop_back(); cold.pop_back(); denseSlot.pop_back();
+    }
+
+    // Dọn xe đã hạ cuối tick: mỗi xe một lần đổi chỗ, không dời cả mảng
+    void removeInactive() { for (int i = 0; i < size();) if (!hot[i].active) removeAt(i); else ++i; }
+
+    int nextRand(int i) { Uint32& r = cold[i].rngState; r ^= r << 13; r ^= r >> 17; r ^= r << 5; return (int)(r >> 1); }
+
+    void resetShootCooldown(int i) {
+        int level = cold[i].level;
         int levelAdjMin = (level - 1) * DELAY_REDUCTION_PER_LEVEL_MIN;
         int levelAdjRange = (level - 1) * DELAY_REDUCTION_PER_LEVEL_RANGE;
         int currentMin = max(MIN_POSSIBLE_DELAY, ENEMY_BASE_MIN_DELAY - levelAdjMin);
         int currentRange = max(MIN_POSSIBLE_RANGE, ENEMY_BASE_RANGE - levelAdjRange);
         if (currentRange < 1) currentRange = 1;
-        shootDelay = currentMin + rand() % currentRange;
+        cold[i].shootDelay = currentMin + nextRand(i) % currentRange;
     }
 
-    void takeHit() {
-        if (!active) return;
-        hitPoints--; isHit = true; hitStartTime = SDL_GetTicks();
-        if (hitPoints <= 0) {
-            active = false;
-            if (destroySound) Mix_PlayChannel(-1, destroySound, 0);
-        }
+    // nowTick: số tick mô phỏng do Game cung cấp, không phụ thuộc đồng hồ thật. Âm thanh do Game gửi vào SoundBoard.
+    void takeHit(int i, Uint32 nowTick) {
+        EnemyHot& h = hot[i];
+        if (!h.active) return;
+        h.hitPoints--; cold[i].isHit = true; cold[i].hitStartTick = nowTick;
+        if (h.hitPoints <= 0) h.active = false;
     }
 
-    void updateHitStatus() {
-        if (isHit && SDL_GetTicks() > hitStartTime + ENEMY_HIT_FLASH_DURATION) {
-            isHit = false;
-        }
+    void updateHitStatus(int i, Uint32 nowTick) {
+        if (cold[i].isHit && nowTick > cold[i].hitStartTick + ENEMY_HIT_FLASH_TICKS) cold[i].isHit = false;
     }
 
-    bool shoot() {
-        if (!active) return false;
-        float bulletStartX = rect.x + TILE_SIZE / 2.0f;
-        float bulletStartY = rect.y + TILE_SIZE / 2.0f;
-        if (lastDirX > 0) bulletStartX += TILE_SIZE / 2.0f + 1; else if (lastDirX < 0) bulletStartX -= TILE_SIZE / 2.0f + 1;
-        if (lastDirY > 0) bulletStartY += TILE_SIZE / 2.0f + 1; else if (lastDirY < 0) bulletStartY -= TILE_SIZE / 2.0f + 1;
-        bullets.push_back(Bullet(bulletStartX, bulletStartY, lastDirX, lastDirY));
-        if (shootSound) Mix_PlayChannel(-1, shootSound, 0);
+    bool shoot(int i, BulletPool& bullets) {
+        if (!hot[i].active) return false;
+        hot[i].fireBullet(bullets, OWNER_ENEMY_BASE + cold[i].id);
         return true;
     }
 
     // --- HÀM AI CẢI TIẾN ---
-    void updateAIAndVelocity(const PlayerTank& p1, const PlayerTank& p2, int numPlayers, const vector<Wall>& walls);
+    // Pha AI: chỉ đọc ảnh chụp (người chơi, địa hình, enemyRects, trường hướng) và chỉ ghi trạng thái của
+    // chính xe i, nên các xe có thể chạy song song. Việc bắn được ghi vào wantsToShoot cho pha áp dụng.
+    void updateAIAndVelocity(int i, const PlayerTank& p1, const PlayerTank& p2, int numPlayers, const TileGrid& terrain, const SightLines& sight,
+                             const vector<SDL_Rect>& enemyRects, const SpatialGrid& enemyGrid, const FlowField* playerFlow);
+
+    // Đi theo trường hướng: tra hướng của ô đang đứng; nếu lệch khỏi hàng/cột của ô theo trục vuông góc
+    // thì căn thẳng trước (lệch dưới một bước thì nắn luôn vị trí, như "trợ lực góc" của Battle City).
+    bool followFlow(int i, const FlowField& field, const TileGrid& terrain, const vector<SDL_Rect>& enemyRects, const SpatialGrid& enemyGrid) {
+        EnemyHot& h = hot[i];
+        int c = (h.x + TILE_SIZE / 2) / TILE_SIZE, r = (h.y + TILE_SIZE / 2) / TILE_SIZE;
+        int dir = field.nextDir(c, r);
+        if (dir < 0) return false;
+        int dirX = FLOW_DX[dir], dirY = FLOW_DY[dir];
+        int offsetFp = (dirX != 0) ? toFixed(r * TILE_SIZE) - h.fy : toFixed(c * TILE_SIZE) - h.fx;
+        if (std::abs(offsetFp) > ENEMY_SPEED_FP) { // Còn lệch nhiều: đi về phía hàng/cột của ô hiện tại
+            int sign = (offsetFp > 0) ? 1 : -1;
+            if (dirX != 0) { dirX = 0; dirY = sign; } else { dirY = 0; dirX = sign; }
+        } else if (offsetFp != 0) { // Chỉ thu hẹp phần chồng lên ô đã chiếm sẵn nên không thể va tường
+            // prev dời theo cùng độ lệch để hình vẽ nội suy không giật
+            if (dirX != 0) { h.fy += offsetFp; h.prevFy += offsetFp; h.y = fromFixed(h.fy); h.rect.y = h.y; }
+            else { h.fx += offsetFp; h.prevFx += offsetFp; h.x = fromFixed(h.fx); h.rect.x = h.x; }
+        }
+        int vx = dirX * ENEMY_SPEED_FP, vy = dirY * ENEMY_SPEED_FP;
+        if (!isMoveValid(i, fromFixed(h.fx + vx), fromFixed(h.fy + vy), terrain, enemyRects, enemyGrid)) return false;
+        h.velocityX = vx; h.velocityY = vy; h.lastDirX = dirX; h.lastDirY = dirY;
+        return true;
+    }
+
+    // Rect r của xe i có chạm xe tăng địch khác không. Bỏ qua xe đang chồng lên nó sẵn để hai xe có thể tách ra.
+    // enemyRects: hình chữ nhật của các xe theo chỉ số đầu tick (xe đã hạ có w = 0 nên không bao giờ giao)
+    bool blockedByOtherEnemy(int i, const SDL_Rect& r, const vector<SDL_Rect>& enemyRects, const SpatialGrid& enemyGrid) const {
+        const SDL_Rect& self = hot[i].rect;
+        return enemyGrid.firstMatch(r, [&](int id) {
+            const SDL_Rect& other = enemyRects[id];
+            return id != i && SDL_HasIntersection(&r, &other) && !SDL_HasIntersection(&self, &other);
+        }) >= 0;
+    }
 
     // --- HÀM KIỂM TRA DI CHUYỂN HỢP LỆ ---
-    bool isMoveValid(int nextX, int nextY, const vector<Wall>& walls) const {
+    bool isMoveValid(int i, int nextX, int nextY, const TileGrid& terrain, const vector<SDL_Rect>& enemyRects, const SpatialGrid& enemyGrid) const {
         SDL_Rect futureRect = {nextX, nextY, TILE_SIZE, TILE_SIZE};
         if (nextX < TILE_SIZE || nextX + TILE_SIZE > SCREEN_WIDTH - TILE_SIZE ||
             nextY < TILE_SIZE || nextY + TILE_SIZE > SCREEN_HEIGHT - TILE_SIZE) {
             return false; // Va biên
         }
-        for (const auto& w : walls) {
-            if (w.active && w.type != WallType::BUSH && SDL_HasIntersection(&futureRect, &w.rect)) {
-                return false; // Va tường
-            }
-        }
-        // TODO (Optional): Check collision with other EnemyTanks
+        if (terrain.blocksTank(futureRect)) return false; // Va tường
+        if (blockedByOtherEnemy(i, futureRect, enemyRects, enemyGrid)) return false; // Va xe tăng địch khác
         return true; // Hợp lệ
     }
 
-    void updatePosition(const vector<Wall>& walls) {
-        if (!active || (velocityX == 0 && velocityY == 0)) return;
-
-        int originalX = x, originalY = y;
-
-        // Di chuyển X
-        x += velocityX; rect.x = x;
-        bool collisionX = false;
-        for (const auto& w : walls) {
-            if (w.active && w.type != WallType::BUSH && SDL_HasIntersection(&rect, &w.rect)) {
-                x = originalX; rect.x = x; collisionX = true; break;
-            }
-        }
-        if (!collisionX) { // Kiểm tra biên X sau tường
-            if (x < TILE_SIZE) x = TILE_SIZE;
-            else if (x + rect.w > SCREEN_WIDTH - TILE_SIZE) x = SCREEN_WIDTH - TILE_SIZE - rect.w;
-            rect.x = x;
-        }
-
-        // Di chuyển Y
-        y += velocityY; rect.y = y;
-        bool collisionY = false;
-        for (const auto& w : walls) {
-            if (w.active && w.type != WallType::BUSH && SDL_HasIntersection(&rect, &w.rect)) {
-                y = originalY; rect.y = y; collisionY = true; break;
-            }
-        }
-         if (!collisionY) { // Kiểm tra biên Y sau tường
-            if (y < TILE_SIZE) y = TILE_SIZE;
-            else if (y + rect.h > SCREEN_HEIGHT - TILE_SIZE) y = SCREEN_HEIGHT - TILE_SIZE - rect.h;
-            rect.y = y;
-        }
+    void updatePosition(int i, const TileGrid& terrain, const vector<SDL_Rect>& enemyRects, const SpatialGrid& enemyGrid) {
+        EnemyHot& h = hot[i];
+        if (!h.active) { h.prevFx = h.fx; h.prevFy = h.fy; return; }
+        h.integrate([&]() { return terrain.blocksTank(h.rect) || blockedByOtherEnemy(i, h.rect, enemyRects, enemyGrid); });
     }
 
-    void updateBullets() {
-        if (!active) { bullets.clear(); return; }
-        for (auto &b : bullets) if (b.active) b.move();
-        bullets.erase(remove_if(bullets.begin(), bullets.end(), [](const Bullet &b){ return !b.active; }), bullets.end());
+private:
+    struct Slot { Uint32 dense = 0, generation = 0; };
+    vector<Slot> slots;        // Theo EnemyHandle::slot
+    vector<Uint32> denseSlot;  // Chỉ số dày đặc -> slot
+    vector<Uint32> freeSlots;
+
+    EnemyHandle place(Uint32 s, int startX, int startY, int level, Uint32 seed, int initialHP) {
+        int i = size();
+        slots[s].dense = (Uint32)i; denseSlot.push_back(s);
+        EnemyHot h; h.placeAt(startX, startY); h.velocityY = ENEMY_SPEED_FP; h.lastDirX = 0; h.lastDirY = 1; h.hitPoints = initialHP;
+        EnemyCold c; c.level = level; c.initialHitPoints = initialHP; c.rngState = (seed << 1) | 1;
+        hot.push_back(h); cold.push_back(c);
+        cold[i].moveDecisionDelay = 40 + nextRand(i) % 80;
+        resetShootCooldown(i);
+        return {s, slots[s].generation};
     }
 };
 
-
-// --- ĐỊNH NGHĨA HÀM AI CẢI TIẾN CHO ENEMY TANK ---
-void EnemyTank::updateAIAndVelocity(const PlayerTank& p1, const PlayerTank& p2, int numPlayers, const vector<Wall>& walls) {
-    if (!active) {
+void EnemyStore::updateAIAndVelocity(int i, const PlayerTank& p1, const PlayerTank& p2, int numPlayers, const TileGrid& terrain, const SightLines& sight,
+                                     const vector<SDL_Rect>& enemyRects, const SpatialGrid& enemyGrid, const FlowField* playerFlow) {
+    EnemyHot& h = hot[i]; EnemyCold& c = cold[i];
+    if (!h.active) {
         return; // Không làm gì nếu đã bị hạ
     }
 
@@ -301,16 +955,16 @@ void EnemyTank::updateAIAndVelocity(const PlayerTank& p1, const PlayerTank& p2,
     int targetX = -1, targetY = -1; // Tọa độ mục tiêu
 
     if (p1.isActive) {
-        float dx1 = p1.x + TILE_SIZE / 2.0f - (this->x + TILE_SIZE / 2.0f);
-        float dy1 = p1.y + TILE_SIZE / 2.0f - (this->y + TILE_SIZE / 2.0f);
+        float dx1 = p1.x + TILE_SIZE / 2.0f - (h.x + TILE_SIZE / 2.0f);
+        float dy1 = p1.y + TILE_SIZE / 2.0f - (h.y + TILE_SIZE / 2.0f);
         float distSq1 = dx1 * dx1 + dy1 * dy1;
         if (distSq1 < minDistSq) {
             minDistSq = distSq1; targetPlayer = &p1; targetX = p1.x; targetY = p1.y;
         }
     }
     if (numPlayers == 2 && p2.isActive) {
-        float dx2 = p2.x + TILE_SIZE / 2.0f - (this->x + TILE_SIZE / 2.0f);
-        float dy2 = p2.y + TILE_SIZE / 2.0f - (this->y + TILE_SIZE / 2.0f);
+        float dx2 = p2.x + TILE_SIZE / 2.0f - (h.x + TILE_SIZE / 2.0f);
+        float dy2 = p2.y + TILE_SIZE / 2.0f - (h.y + TILE_SIZE / 2.0f);
         float distSq2 = dx2 * dx2 + dy2 * dy2;
         if (distSq2 < minDistSq) {
             minDistSq = distSq2; targetPlayer = &p2; targetX = p2.x; targetY = p2.y;
@@ -318,71 +972,54 @@ void EnemyTank::updateAIAndVelocity(const PlayerTank& p1, const PlayerTank& p2,
     }
 
     // --- B. Quyết Định Bắn ---
-    if (--shootDelay <= 0) {
+    if (--c.shootDelay <= 0) {
         bool shouldShoot = false;
         if (targetPlayer) {
-            float dx = targetX - this->x; float dy = targetY - this->y;
-            bool alignedX = (lastDirX != 0) && (std::abs(dy) < TILE_SIZE * 0.6f) && ((dx > 0 && lastDirX > 0) || (dx < 0 && lastDirX < 0));
-            bool alignedY = (lastDirY != 0) && (std::abs(dx) < TILE_SIZE * 0.6f) && ((dy > 0 && lastDirY > 0) || (dy < 0 && lastDirY < 0));
-            if (alignedX || alignedY) shouldShoot = true;
+            float dx = targetX - h.x; float dy = targetY - h.y;
+            bool alignedX = (h.lastDirX != 0) && (std::abs(dy) < TILE_SIZE * 0.6f) && ((dx > 0 && h.lastDirX > 0) || (dx < 0 && h.lastDirX < 0));
+            bool alignedY = (h.lastDirY != 0) && (std::abs(dx) < TILE_SIZE * 0.6f) && ((dy > 0 && h.lastDirY > 0) || (dy < 0 && h.lastDirY < 0));
+            // Thẳng hàng nhưng có gạch/thép chắn giữa thì không tính là ngắm trúng (chỉ còn cơ hội bắn ngẫu nhiên)
+            if ((alignedX || alignedY) && sight.clearShot(h.x + TILE_SIZE / 2, h.y + TILE_SIZE / 2, targetX + TILE_SIZE / 2, targetY + TILE_SIZE / 2, alignedX))
+                shouldShoot = true;
         }
-        if (!shouldShoot && (rand() % 5 == 0)) shouldShoot = true; // 1/5 cơ hội bắn ngẫu nhiên
+        if (!shouldShoot && (nextRand(i) % 5 == 0)) shouldShoot = true; // 1/5 cơ hội bắn ngẫu nhiên
 
         if (shouldShoot) {
-            shoot(); resetShootCooldown();
+            c.wantsToShoot = true; resetShootCooldown(i);
         } else {
-             resetShootCooldown(); shootDelay = std::max(MIN_POSSIBLE_DELAY, shootDelay / 3 + 5);
+             resetShootCooldown(i); c.shootDelay = std::max(MIN_POSSIBLE_DELAY, c.shootDelay / 3 + 5);
         }
     }
 
     // --- C. Quyết Định Di Chuyển ---
-    if (--moveDecisionDelay <= 0) {
-        moveDecisionDelay = 40 + rand() % 80;
+    // Đuổi theo: ở mọi ô trường hướng của mục tiêu tới được thì bám theo nó mỗi tick (tra bảng O(1)).
+    // Đi lang thang ngẫu nhiên chỉ còn cho lúc không có mục tiêu, không có đường, hoặc đang đi vòng.
+    if (c.flowDetourTicks > 0) c.flowDetourTicks--;
+    else if (targetPlayer) {
+        const FlowField& field = playerFlow[targetPlayer == &p1 ? 0 : 1];
+        if (field.distance((h.x + TILE_SIZE / 2) / TILE_SIZE, (h.y + TILE_SIZE / 2) / TILE_SIZE) != FlowField::UNREACHABLE) {
+            if (followFlow(i, field, terrain, enemyRects, enemyGrid)) { c.moveDecisionDelay = 0; return; }
+            c.flowDetourTicks = 20 + nextRand(i) % 40; c.moveDecisionDelay = 0; // Bị chặn (thường bởi xe tăng khác): đi vòng một lúc
+        }
+    }
+
+    if (--c.moveDecisionDelay <= 0) {
+        c.moveDecisionDelay = 40 + nextRand(i) % 80;
 
         struct MoveOption { int vx, vy, dirX, dirY; };
-        vector<MoveOption> options = { {0, -ENEMY_SPEED, 0, -1}, {0, ENEMY_SPEED, 0, 1}, {-ENEMY_SPEED, 0, -1, 0}, {ENEMY_SPEED, 0, 1, 0} };
-        random_shuffle(options.begin(), options.end());
+        MoveOption options[4] = { {0, -ENEMY_SPEED_FP, 0, -1}, {0, ENEMY_SPEED_FP, 0, 1}, {-ENEMY_SPEED_FP, 0, -1, 0}, {ENEMY_SPEED_FP, 0, 1, 0} };
+        for (int k = 3; k > 0; --k) std::swap(options[k], options[nextRand(i) % (k + 1)]);
 
-        int bestVx = 0, bestVy = 0; int bestDirX = lastDirX, bestDirY = lastDirY; // Giữ hướng cũ làm mặc định nếu bị kẹt
+        int bestVx = 0, bestVy = 0; int bestDirX = h.lastDirX, bestDirY = h.lastDirY; // Giữ hướng cũ làm mặc định nếu bị kẹt
         bool foundValidMove = false;
 
-        const float CHASE_DISTANCE_THRESHOLD_SQ = (TILE_SIZE * 7.0f) * (TILE_SIZE * 7.0f);
-        bool chaseMode = (targetPlayer && minDistSq < CHASE_DISTANCE_THRESHOLD_SQ);
-
-        if (chaseMode) {
-            float dx = targetX - this->x; float dy = targetY - this->y;
-            int chaseVx = 0, chaseVy = 0; int chaseDirX = lastDirX, chaseDirY = lastDirY;
-
-            if (std::abs(dx) > std::abs(dy) + TILE_SIZE * 0.2f) {
-                chaseVx = (dx > 0) ? ENEMY_SPEED : -ENEMY_SPEED; chaseDirX = (dx > 0) ? 1 : -1; chaseDirY = 0;
-            } else if (std::abs(dy) > std::abs(dx) + TILE_SIZE * 0.2f) {
-                chaseVy = (dy > 0) ? ENEMY_SPEED : -ENEMY_SPEED; chaseDirY = (dy > 0) ? 1 : -1; chaseDirX = 0;
-            } else {
-                bool movingTowardsTarget = !((velocityX > 0 && dx < 0) || (velocityX < 0 && dx > 0) || (velocityY > 0 && dy < 0) || (velocityY < 0 && dy > 0));
-                if (movingTowardsTarget && (velocityX != 0 || velocityY != 0)) {
-                    chaseVx = velocityX; chaseVy = velocityY; chaseDirX = lastDirX; chaseDirY = lastDirY;
-                } else {
-                    if (rand() % 2 == 0 && std::abs(dx) > TILE_SIZE * 0.1f) {
-                       chaseVx = (dx > 0) ? ENEMY_SPEED : -ENEMY_SPEED; chaseDirX = (dx > 0) ? 1 : -1; chaseDirY = 0;
-                    } else if (std::abs(dy) > TILE_SIZE * 0.1f) {
-                       chaseVy = (dy > 0) ? ENEMY_SPEED : -ENEMY_SPEED; chaseDirY = (dy > 0) ? 1 : -1; chaseDirX = 0;
-                    } else { chaseMode = false; }
-                }
-            }
-
-            if (chaseMode && isMoveValid(this->x + chaseVx, this->y + chaseVy, walls)) {
-                 bestVx = chaseVx; bestVy = chaseVy; bestDirX = chaseDirX; bestDirY = chaseDirY;
-                 foundValidMove = true;
-            }
-        }
-
         if (!foundValidMove) {
             int reverseVx = 0, reverseVy = 0, reverseDirX = 0, reverseDirY = 0; // Lưu hướng quay đầu nếu có
             bool reversePossible = false;
 
             for (const auto& option : options) {
-                bool isReversing = (option.vx == -this->velocityX && option.vy == -this->velocityY && (velocityX !=0 || velocityY !=0));
-                if (isMoveValid(this->x + option.vx, this->y + option.vy, walls)) {
+                bool isReversing = (option.vx == -h.velocityX && option.vy == -h.velocityY && (h.velocityX !=0 || h.velocityY !=0));
+                if (isMoveValid(i, fromFixed(h.fx + option.vx), fromFixed(h.fy + option.vy), terrain, enemyRects, enemyGrid)) {
                     if (!isReversing) { // Ưu tiên hướng không quay đầu
                         bestVx = option.vx; bestVy = option.vy; bestDirX = option.dirX; bestDirY = option.dirY;
                         foundValidMove = true;
@@ -401,11 +1038,11 @@ void EnemyTank::updateAIAndVelocity(const PlayerTank& p1, const PlayerTank& p2,
         }
 
         if (foundValidMove) {
-             if(bestVx != velocityX || bestVy != velocityY || (velocityX == 0 && velocityY == 0)) {
-                velocityX = bestVx; velocityY = bestVy; lastDirX = bestDirX; lastDirY = bestDirY;
+             if(bestVx != h.velocityX || bestVy != h.velocityY || (h.velocityX == 0 && h.velocityY == 0)) {
+                h.velocityX = bestVx; h.velocityY = bestVy; h.lastDirX = bestDirX; h.lastDirY = bestDirY;
              }
         } else {
-             velocityX = 0; velocityY = 0; // Bị kẹt, đứng yên
+             h.velocityX = 0; h.velocityY = 0; // Bị kẹt, đứng yên
              // Giữ nguyên lastDirX, lastDirY
         }
     } // End if (--moveDecisionDelay <= 0)
@@ -413,50 +1050,1311 @@ void EnemyTank::updateAIAndVelocity(const PlayerTank& p1, const PlayerTank& p2,
 
 
 // --- ĐỊNH NGHĨA HÀM PlayerTank::updatePosition ---
-// Cần định nghĩa sau khi EnemyTank đã được định nghĩa đầy đủ
-void PlayerTank::updatePosition(const vector<Wall>& walls, const vector<EnemyTank>& enemies) {
-    if (!isActive || (velocityX == 0 && velocityY == 0)) return;
+// Cần định nghĩa sau khi EnemyStore đã được định nghĩa đầy đủ
+void PlayerTank::updatePosition(const TileGrid& terrain, const EnemyStore& enemies, const SpatialGrid& enemyGrid) {
+    if (!isActive) { prevFx = fx; prevFy = fy; return; }
+    auto hitsEnemy = [&](int id) { return enemies.hot[id].active && SDL_HasIntersection(&rect, &enemies.hot[id].rect); };
+    integrate([&]() { return terrain.blocksTank(rect) || enemyGrid.firstMatch(rect, hitsEnemy) >= 0; });
+}
 
-    int originalX = x, originalY = y;
 
-    // Di chuyển X và kiểm tra va chạm
-    x += velocityX; rect.x = x;
-    bool collisionX = false;
-    for (const auto& w : walls) if (w.active && w.type != WallType::BUSH && SDL_HasIntersection(&rect, &w.rect)) { x = originalX; rect.x = x; collisionX = true; break; }
-    if (!collisionX) for (const auto& e : enemies) if (e.active && SDL_HasIntersection(&rect, &e.rect)) { x = originalX; rect.x = x; collisionX = true; break; }
-    if (!collisionX) { // Kiểm tra biên X
-        if (x < TILE_SIZE) x = TILE_SIZE;
-        else if (x + rect.w > SCREEN_WIDTH - TILE_SIZE) x = SCREEN_WIDTH - TILE_SIZE - rect.w;
-        rect.x = x;
-    }
+// =============================================================================
+// == Gói Tài Nguyên Dựng Sẵn (Asset Bundle) ==
+// =============================================================================
+// "battlecity --pack-assets" giải mã mọi ảnh (RGBA32, kể cả atlas đã xếp sẵn) và mọi WAV
+// (PCM theo định dạng mở mixer) vào một file duy nhất. Lúc chạy, file được mmap và surface/chunk
+// trỏ thẳng vào vùng ánh xạ: không đọc, không giải mã, không sao chép. Nếu không có gói (hoặc
+// định dạng âm thanh khác), ảnh và âm thanh được giải mã từ file gốc trên các luồng phụ.
 
-    // Di chuyển Y và kiểm tra va chạm
-    y += velocityY; rect.y = y;
-    bool collisionY = false;
-    for (const auto& w : walls) if (w.active && w.type != WallType::BUSH && SDL_HasIntersection(&rect, &w.rect)) { y = originalY; rect.y = y; collisionY = true; break; }
-    if (!collisionY) for (const auto& e : enemies) if (e.active && SDL_HasIntersection(&rect, &e.rect)) { y = originalY; rect.y = y; collisionY = true; break; }
-    if (!collisionY) { // Kiểm tra biên Y
-        if (y < TILE_SIZE) y = TILE_SIZE;
-        else if (y + rect.h > SCREEN_HEIGHT - TILE_SIZE) y = SCREEN_HEIGHT - TILE_SIZE - rect.h;
-        rect.y = y;
-    }
+// Chạy fn(0..count-1) trên các luồng phụ (luồng gọi cũng tham gia)
+template <class F> void parallelFor(int count, F fn) {
+    int workers = min(count, max(1, (int)std::thread::hardware_concurrency()));
+    std::atomic<int> next(0);
+    auto work = [&]() { for (int i = next++; i < count; i = next++) fn(i); };
+    vector<std::thread> pool;
+    for (int t = 1; t < workers; ++t) pool.emplace_back(work);
+    work();
+    for (auto& th : pool) th.join();
 }
 
+// IMG_Load + chuyển sang RGBA32. An toàn khi gọi từ luồng phụ (không đụng renderer).
+SDL_Surface* decodeImageFile(const char* path) {
+    SDL_Surface* loaded = IMG_Load(path);
+    if (!loaded) return nullptr;
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    return converted;
+}
 
-// =============================================================================
-// == Lớp Game (Quản lý chính) ==
-// =============================================================================
-class Game {
+// Đọc WAV và chuyển sang định dạng PCM của thiết bị (không cần mixer, chạy được trên luồng phụ)
+bool decodeWavFile(const char* path, int freq, Uint16 format, int channels, vector<Uint8>& out) {
+    SDL_AudioSpec spec; Uint8* buffer = nullptr; Uint32 length = 0;
+    if (!SDL_LoadWAV(path, &spec, &buffer, &length)) return false;
+    SDL_AudioCVT cvt;
+    int needed = SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, format, (Uint8)channels, freq);
+    if (needed < 0) { SDL_FreeWAV(buffer); return false; }
+    out.resize((size_t)length * max(1, cvt.len_mult));
+    memcpy(out.data(), buffer, length);
+    SDL_FreeWAV(buffer);
+    if (needed == 0) { out.resize(length); return true; }
+    cvt.buf = out.data(); cvt.len = (int)length;
+    if (SDL_ConvertAudio(&cvt) < 0) return false;
+    out.resize(cvt.len_cvt);
+    return true;
+}
+
+// File chỉ đọc được ánh xạ vào bộ nhớ
+class MappedFile {
 public:
-    SDL_Window* window = nullptr;
-    SDL_Renderer* renderer = nullptr;
-    bool running = true;
-    GameState currentState = GameState::SELECT_MODE;
-    int numberOfPlayers = 1;
-    vector<Wall> walls;
-    PlayerTank player1;
+    ~MappedFile() { close(); }
+
+    bool open(const char* path) {
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { close(); return false; }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) { close(); return false; }
+        bytes = (const Uint8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        length = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+        void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+        bytes = (const Uint8*)view; length = (size_t)st.st_size;
+#endif
+        if (!bytes) { close(); return false; }
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr; file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap((void*)bytes, length);
+#endif
+        bytes = nullptr; length = 0;
+    }
+
+    const Uint8* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const Uint8* bytes = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// Bố cục file: BundleHeader, BundleEntry[entryCount], rồi dữ liệu (mỗi khối căn 64 byte)
+const char BUNDLE_MAGIC[8] = {'B', 'C', 'B', 'U', 'N', 'D', 'L', '1'};
+const Uint32 BUNDLE_VERSION = 1;
+enum class BundleKind : Uint32 { IMAGE = 1, PCM = 2, BLOB = 3 };
+
+struct BundleHeader { char magic[8]; Uint32 version; Uint32 entryCount; };
+struct BundleEntry {
+    char name[40];
+    BundleKind kind;
+    Uint32 a, b, c;        // IMAGE: w, h, pitch (RGBA32) | PCM: freq, format, channels
+    Uint64 offset, size;   // Vị trí dữ liệu tính từ đầu file
+};
+
+class AssetBundle {
+public:
+    bool open(const char* path) {
+        if (!file.open(path)) return false;
+        if (file.size() < sizeof(BundleHeader)) { file.close(); return false; }
+        const BundleHeader* header = (const BundleHeader*)file.data();
+        if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 || header->version != BUNDLE_VERSION ||
+            sizeof(BundleHeader) + (Uint64)header->entryCount * sizeof(BundleEntry) > file.size()) {
+            LOG_WARN("%s is not a valid asset bundle, ignoring it.", path);
+            file.close(); return false;
+        }
+        entries = (const BundleEntry*)(file.data() + sizeof(BundleHeader));
+        entryCount = header->entryCount;
+        for (Uint32 i = 0; i < entryCount; ++i) {
+            if (!entryValid(entries[i], file.size())) { LOG_WARN("Truncated or corrupt asset bundle %s (entry %u), ignoring it.", path, i); close(); return false; }
+        }
+        return true;
+    }
+
+    void close() { file.close(); entries = nullptr; entryCount = 0; }
+    bool isOpen() const { return entries != nullptr; }
+
+    const BundleEntry* find(const char* name, BundleKind kind) const {
+        for (Uint32 i = 0; i < entryCount; ++i) if (entries[i].kind == kind && strncmp(entries[i].name, name, sizeof(entries[i].name)) == 0) return &entries[i];
+        return nullptr;
+    }
+
+    const Uint8* data(const BundleEntry& e) const { return file.data() + e.offset; }
+
+    // Surface trỏ thẳng vào vùng ánh xạ (không sao chép); chỉ dùng khi gói còn mở
+    SDL_Surface* surface(const char* name) const {
+        const BundleEntry* e = find(name, BundleKind::IMAGE);
+        if (!e) return nullptr;
+        return SDL_CreateRGBSurfaceWithFormatFrom((void*)data(*e), (int)e->a, (int)e->b, 32, (int)e->c, SDL_PIXELFORMAT_RGBA32);
+    }
+
+private:
+    MappedFile file;
+    const BundleEntry* entries = nullptr;
+    Uint32 entryCount = 0;
+
+    // Kiểm tra một lần lúc mở: dữ liệu nằm trọn trong file, ảnh có pitch >= w*4 và pitch*h <= size,
+    // nên surface()/data() sau đó không bao giờ đọc ra ngoài vùng ánh xạ
+    static bool entryValid(const BundleEntry& e, size_t fileSize) {
+        if (e.offset > fileSize || e.size > fileSize - e.offset) return false;
+        if (e.kind == BundleKind::IMAGE) {
+            const Uint32 MAX_SIDE = 16384;
+            if (e.a == 0 || e.b == 0 || e.a > MAX_SIDE || e.b > MAX_SIDE || e.c > (Uint32)INT_MAX) return false;
+            if (e.c < (Uint64)e.a * 4 || (Uint64)e.c * e.b > e.size) return false;
+        }
+        return true;
+    }
+};
+
+// =============================================================================
+// == Texture Atlas và Vẽ Theo Lô (SpriteAtlas, SpriteBatch) ==
+// =============================================================================
+// Mọi sprite xe tăng, đạn và ô địa hình được ghép vào một texture duy nhất lúc nạp.
+// Mỗi khung hình các sprite được gom thành một lô đỉnh và gửi bằng một lệnh SDL_RenderGeometry;
+// màu nháy khi địch trúng đạn nằm trong màu từng đỉnh nên không phải đổi ColorMod/AlphaMod của texture.
+enum class SpriteId {
+    BRICK, STEEL, WATER, GRASS, BULLET,
+    PLAYER1_UP, PLAYER1_DOWN, PLAYER1_LEFT, PLAYER1_RIGHT,
+    PLAYER2_UP, PLAYER2_DOWN, PLAYER2_LEFT, PLAYER2_RIGHT,
+    ENEMY2_UP, ENEMY2_DOWN, ENEMY2_LEFT, ENEMY2_RIGHT,
+    ENEMY3_UP, ENEMY3_DOWN, ENEMY3_LEFT, ENEMY3_RIGHT,
+    COUNT
+};
+
+// Sprite theo hướng, với 4 hướng xếp liên tiếp UP, DOWN, LEFT, RIGHT bắt đầu từ 'up'
+inline SpriteId tankSprite(SpriteId up, int dirX, int dirY, SpriteId fallback) {
+    if (dirY < 0) return up;
+    if (dirY > 0) return (SpriteId)((int)up + 1);
+    if (dirX < 0) return (SpriteId)((int)up + 2);
+    if (dirX > 0) return (SpriteId)((int)up + 3);
+    return fallback;
+}
+
+class SpriteAtlas {
+public:
+    SDL_Texture* texture = nullptr;
+    int width = 0, height = 0;
+    SDL_Rect regions[(int)SpriteId::COUNT] = {}; // w == 0: sprite không có
+
+    void destroy() { if (texture) SDL_DestroyTexture(texture); texture = nullptr; } // Gọi trước SDL_DestroyRenderer
+
+    bool has(SpriteId id) const { return regions[(int)id].w > 0; }
+
+    // Giải mã song song từng ảnh rồi xếp theo kệ (shelf packing) vào một surface RGBA, cách nhau 1 px
+    // để tránh lem khi co giãn. Điền regions/width/height; texture được tạo riêng bằng upload().
+    SDL_Surface* packFromFiles(bool& essentialOk) {
+        struct SpriteFile { SpriteId id; const char* path; bool essential; };
+        static const SpriteFile files[] = {
+            {SpriteId::BRICK, "brick.png", true}, {SpriteId::STEEL, "steel.png", true}, {SpriteId::WATER, "water.png", true},
+            {SpriteId::GRASS, "grass.png", false}, {SpriteId::BULLET, "Bullet.png", true},
+            {SpriteId::PLAYER1_UP, "tank1U.png", true}, {SpriteId::PLAYER1_DOWN, "tank1D.png", true}, {SpriteId::PLAYER1_LEFT, "tank1L.png", true}, {SpriteId::PLAYER1_RIGHT, "tank1R.png", true},
+            {SpriteId::PLAYER2_UP, "tank_player2U.png", true}, {SpriteId::PLAYER2_DOWN, "tank_player2D.png", true}, {SpriteId::PLAYER2_LEFT, "tank_player2L.png", true}, {SpriteId::PLAYER2_RIGHT, "tank_player2R.png", true},
+            {SpriteId::ENEMY2_UP, "tank2U.png", true}, {SpriteId::ENEMY2_DOWN, "tank2D.png", true}, {SpriteId::ENEMY2_LEFT, "tank2L.png", true}, {SpriteId::ENEMY2_RIGHT, "tank2R.png", true},
+            {SpriteId::ENEMY3_UP, "tank3U.png", true}, {SpriteId::ENEMY3_DOWN, "tank3D.png", true}, {SpriteId::ENEMY3_LEFT, "tank3L.png", true}, {SpriteId::ENEMY3_RIGHT, "tank3R.png", true},
+        };
+        const int FILE_COUNT = sizeof(files) / sizeof(files[0]);
+        const int ATLAS_WIDTH = 512, PADDING = 1;
+        SDL_Surface* decoded[FILE_COUNT] = {};
+        parallelFor(FILE_COUNT, [&](int i) { decoded[i] = decodeImageFile(files[i].path); });
+
+        essentialOk = true;
+        SDL_Surface* images[(int)SpriteId::COUNT] = {};
+        int penX = 0, penY = 0, shelfHeight = 0;
+        for (int i = 0; i < FILE_COUNT; ++i) {
+            const SpriteFile& f = files[i]; SDL_Surface* img = decoded[i];
+            if (!img) {
+                logMessage(f.essential ? LogLevel::ERROR : LogLevel::WARN, "Unable to load image %s! SDL_image Error: %s", f.path, IMG_GetError());
+                if (f.essential) essentialOk = false;
+                continue;
+            }
+            if (penX + img->w > ATLAS_WIDTH) { penX = 0; penY += shelfHeight + PADDING; shelfHeight = 0; }
+            regions[(int)f.id] = {penX, penY, img->w, img->h};
+            penX += img->w + PADDING; shelfHeight = max(shelfHeight, img->h);
+            images[(int)f.id] = img;
+        }
+        width = ATLAS_WIDTH; height = penY + shelfHeight;
+
+        SDL_Surface* atlas = (height > 0) ? SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32) : nullptr;
+        for (int i = 0; i < (int)SpriteId::COUNT; ++i) {
+            if (!images[i]) continue;
+            if (atlas) {
+                SDL_Rect dst = regions[i];
+                SDL_SetSurfaceBlendMode(images[i], SDL_BLENDMODE_NONE); // Chép nguyên kênh alpha
+                SDL_BlitSurface(images[i], nullptr, atlas, &dst);
+            }
+            SDL_FreeSurface(images[i]);
+        }
+        if (!atlas) LOG_ERROR("Unable to build sprite atlas! SDL Error: %s", SDL_GetError());
+        return atlas;
+    }
+
+    bool upload(SDL_Renderer* renderer, SDL_Surface* atlas) {
+        texture = SDL_CreateTextureFromSurface(renderer, atlas);
+        if (!texture) { LOG_ERROR("Unable to create atlas texture! SDL Error: %s", SDL_GetError()); return false; }
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        return true;
+    }
+
+    bool load(SDL_Renderer* renderer) {
+        bool essentialOk = true;
+        SDL_Surface* atlas = packFromFiles(essentialOk);
+        if (!atlas) return false;
+        bool uploaded = upload(renderer, atlas);
+        SDL_FreeSurface(atlas);
+        if (uploaded) LOG_INFO("Built sprite atlas %dx%d", width, height);
+        return essentialOk && uploaded;
+    }
+};
+
+class SpriteBatch {
+public:
+    SpriteBatch() { vertices.reserve(4 * 512); indices.reserve(6 * 512); }
+
+    void add(const SpriteAtlas& atlas, SpriteId id, const SDL_Rect& dst, SDL_Color color = {255, 255, 255, 255}) {
+        if (!atlas.has(id)) return;
+        const SDL_Rect& src = atlas.regions[(int)id];
+        float u0 = src.x / (float)atlas.width, v0 = src.y / (float)atlas.height;
+        float u1 = (src.x + src.w) / (float)atlas.width, v1 = (src.y + src.h) / (float)atlas.height;
+        float x0 = (float)dst.x, y0 = (float)dst.y, x1 = (float)(dst.x + dst.w), y1 = (float)(dst.y + dst.h);
+        int base = (int)vertices.size();
+        vertices.push_back({{x0, y0}, color, {u0, v0}}); vertices.push_back({{x1, y0}, color, {u1, v0}});
+        vertices.push_back({{x1, y1}, color, {u1, v1}}); vertices.push_back({{x0, y1}, color, {u0, v1}});
+        const int quad[6] = {0, 1, 2, 0, 2, 3};
+        for (int k : quad) indices.push_back(base + k);
+    }
+
+    void flush(SDL_Renderer* renderer, const SpriteAtlas& atlas) {
+        if (!indices.empty() && atlas.texture)
+            SDL_RenderGeometry(renderer, atlas.texture, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+        vertices.clear(); indices.clear();
+    }
+
+private:
+    vector<SDL_Vertex> vertices;
+    vector<int> indices;
+};
+
+// =============================================================================
+// == Bộ Đo Khung Hình (Profiler) ==
+// =============================================================================
+// PROFILE_SCOPE(profiler, phase) đo thời gian một khối mã; biên dịch với -DBATTLECITY_PROFILER=0
+// thì các điểm đo, overlay và phím tắt biến mất hoàn toàn. Các khung gần nhất nằm trong vòng đệm
+// (tổng thời gian từng pha, số xe địch/đạn), các lần đo riêng lẻ nằm trong vòng đệm sự kiện để
+// xuất ra JSON trace-event của Chrome (mở bằng chrome://tracing hoặc Perfetto).
+#ifndef BATTLECITY_PROFILER
+#define BATTLECITY_PROFILER 1
+#endif
+
+enum class ProfilePhase { FRAME, EVENTS, UPDATE, AI, COLLISION, RENDER, COUNT };
+const char* const PROFILE_PHASE_NAMES[(int)ProfilePhase::COUNT] = {"frame", "events", "update", "ai", "collision", "render"};
+const int PROFILER_FRAMES = 240;   // ~4 giây ở 60 FPS
+const int PROFILER_EVENTS = 8192;
+const char* const PROFILER_TRACE_PATH = "profile_trace.json";
+
+class Profiler {
+public:
+    struct Frame { Uint64 start = 0; Uint32 phaseNs[(int)ProfilePhase::COUNT] = {}; int enemies = 0, bullets = 0; };
+    struct Event { Uint64 start; Uint32 durationNs; ProfilePhase phase; };
+
+    bool active = false; // Tắt thì mỗi điểm đo chỉ còn một phép so sánh
+
+    Profiler() : nsPerTick(1e9 / (double)SDL_GetPerformanceFrequency()) {}
+
+    Uint64 now() const { return SDL_GetPerformanceCounter(); }
+
+    void record(ProfilePhase phase, Uint64 start, Uint64 end) {
+        Uint32 ns = toNs(end - start);
+        frames[frameHead].phaseNs[(int)phase] += ns;
+        events[eventHead] = {start, ns, phase};
+        eventHead = (eventHead + 1) % PROFILER_EVENTS; eventCount = min(eventCount + 1, PROFILER_EVENTS);
+    }
+
+    void beginFrame() { if (!active) return; frames[frameHead] = Frame(); frames[frameHead].start = now(); }
+
+    void endFrame(int enemies, int bullets) {
+        if (!active) return;
+        Frame& f = frames[frameHead];
+        record(ProfilePhase::FRAME, f.start, now());
+        f.enemies = enemies; f.bullets = bullets;
+        frameHead = (frameHead + 1) % PROFILER_FRAMES; frameCount = min(frameCount + 1, PROFILER_FRAMES);
+    }
+
+    int frameCountRecorded() const { return frameCount; }
+    // i = 0 là khung cũ nhất còn trong vòng đệm
+    const Frame& frame(int i) const { return frames[(frameHead - frameCount + i + PROFILER_FRAMES) % PROFILER_FRAMES]; }
+
+    // Phân vị q (0..1) của thời gian một pha qua các khung trong vòng đệm
+    double phasePercentileMs(ProfilePhase phase, double q) const {
+        if (frameCount == 0) return 0.0;
+        Uint32 values[PROFILER_FRAMES];
+        for (int i = 0; i < frameCount; ++i) values[i] = frame(i).phaseNs[(int)phase];
+        int k = min(frameCount - 1, (int)(q * frameCount));
+        std::nth_element(values, values + k, values + frameCount);
+        return values[k] / 1e6;
+    }
+
+    double phaseAverageMs(ProfilePhase phase) const {
+        if (frameCount == 0) return 0.0;
+        double sum = 0.0;
+        for (int i = 0; i < frameCount; ++i) sum += frame(i).phaseNs[(int)phase];
+        return sum / frameCount / 1e6;
+    }
+
+    // Sự kiện "X" (có thời lượng) cho mỗi lần đo, sự kiện "C" (bộ đếm) cho số xe địch/đạn mỗi khung
+    bool exportTrace(const char* path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) return false;
+        Uint64 origin = UINT64_MAX; // Sự kiện được ghi lúc kết thúc nên pha ngoài bắt đầu sớm hơn pha lồng bên trong
+        for (int i = 0; i < eventCount; ++i) origin = min(origin, events[i].start);
+        if (eventCount == 0) origin = 0;
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (int i = 0; i < eventCount; ++i) {
+            const Event& e = events[(eventHead - eventCount + i + PROFILER_EVENTS) % PROFILER_EVENTS];
+            out << (first ? "" : ",\n") << "{\"name\":\"" << PROFILE_PHASE_NAMES[(int)e.phase] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+                << toUs(e.start - origin) << ",\"dur\":" << e.durationNs / 1000.0 << "}";
+            first = false;
+        }
+        for (int i = 0; i < frameCount; ++i) {
+            const Frame& f = frame(i);
+            if (f.start < origin) continue; // Sự kiện của khung này đã bị ghi đè
+            out << (first ? "" : ",\n") << "{\"name\":\"entities\",\"ph\":\"C\",\"pid\":1,\"ts\":" << toUs(f.start - origin)
+                << ",\"args\":{\"enemies\":" << f.enemies << ",\"bullets\":" << f.bullets << "}}";
+            first = false;
+        }
+        out << "\n]}\n";
+        return (bool)out;
+    }
+
+private:
+    double nsPerTick;
+    Frame frames[PROFILER_FRAMES];
+    Event events[PROFILER_EVENTS];
+    int frameHead = 0, frameCount = 0;
+    int eventHead = 0, eventCount = 0;
+
+    Uint32 toNs(Uint64 ticks) const { return (Uint32)min(ticks * nsPerTick, 4.0e9); }
+    double toUs(Uint64 ticks) const { return ticks * nsPerTick / 1000.0; }
+};
+
+class ProfileScope {
+public:
+    ProfileScope(Profiler& p, ProfilePhase ph) : profiler(p), phase(ph), start(p.active ? p.now() : 0) {}
+    ~ProfileScope() { if (start && profiler.active) profiler.record(phase, start, profiler.now()); }
+private:
+    Profiler& profiler;
+    ProfilePhase phase;
+    Uint64 start;
+};
+
+#if BATTLECITY_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(profiler, phase) ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(profiler, phase)
+#else
+#define PROFILE_SCOPE(profiler, phase) ((void)0)
+#endif
+
+// Phông 3x5 tối giản cho overlay (không phụ thuộc SDL_ttf): mỗi glyph 15 bit, hàng trên cùng ở bit cao
+const char DEBUG_FONT_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.:/-";
+const Uint16 DEBUG_FONT_GLYPHS[] = {
+    0b010101111101101, 0b110101110101110, 0b011100100100011, 0b110101101101110, 0b111100110100111, 0b111100110100100,
+    0b011100101101011, 0b101101111101101, 0b111010010010111, 0b001001001101010, 0b101101110101101, 0b100100100100111,
+    0b101111111101101, 0b110101101101101, 0b010101101101010, 0b110101110100100, 0b010101101110011, 0b110101110101101,
+    0b011100010001110, 0b111010010010010, 0b101101101101111, 0b101101101101010, 0b101101111111101, 0b101101010101101,
+    0b101101010010010, 0b111001010100111,
+    0b111101101101111, 0b010110010010111, 0b110001010100111, 0b110001010001110, 0b101101111001001,
+    0b111100110001110, 0b011100111101111, 0b111001010010010, 0b111101111101111, 0b111101111001110,
+    0b000000000000010, 0b000010000010000, 0b001001010100100, 0b000000111000000,
+};
+
+// =============================================================================
+// == Chuẩn Bị Màn Chơi (LevelPlan) ==
+// =============================================================================
+// Mọi thứ của một màn không cần renderer hay trạng thái Game: tường, bitboard địa hình, trường hướng
+// tới ô xuất phát của người chơi và kế hoạch sinh địch. buildLevelPlan() là hàm thuần (RNG riêng theo
+// seed), nên khi qua màn nó chạy trên luồng nền trong lúc nhạc lên màn phát, rồi Game chỉ việc hoán đổi vào.
+
+// RNG của việc sinh màn (LCG cùng công thức rand() của MinGW), độc lập với RNG của trận
+struct LevelRng {
+    Uint32 state;
+    explicit LevelRng(Uint32 seed) : state(seed) {}
+    int next() { state = state * 1103515245u + 12345u; return (int)((state >> 16) & 0x7FFF); }
+};
+
+const int PLAYER1_START_X = ((MAP_WIDTH / 2) - 2) * TILE_SIZE;
+const int PLAYER2_START_X = ((MAP_WIDTH / 2) + 1) * TILE_SIZE;
+const int PLAYER_START_Y = (MAP_HEIGHT - 2) * TILE_SIZE;
+
+// Hàm GenerateWalls giữ nguyên như cũ (rất phức tạp), chỉ lấy số ngẫu nhiên từ rng thay vì rand()
+void generateWalls(int level, LevelRng& rng, vector<Wall>& walls) { walls.clear(); walls.reserve(MAP_WIDTH * MAP_HEIGHT); int baseCol = MAP_WIDTH / 2; int baseRow = MAP_HEIGHT - 2; int spawnRowTop = 1; auto isProtectedZone = [&](int r, int c) { if (r <= spawnRowTop + 2 && (c < 4 || c > MAP_WIDTH - 5)) return true; if (r >= baseRow - 1 && (c > baseCol - 3 && c < baseCol + 3)) return true; return false; }; for (int i = 0; i < MAP_HEIGHT; ++i) { walls.push_back(Wall(0, i * TILE_SIZE, WallType::STEEL)); walls.push_back(Wall((MAP_WIDTH - 1) * TILE_SIZE, i * TILE_SIZE, WallType::STEEL)); } for (int j = 1; j < MAP_WIDTH - 1; ++j) { walls.push_back(Wall(j * TILE_SIZE, 0, WallType::STEEL)); walls.push_back(Wall(j * TILE_SIZE, (MAP_HEIGHT - 1) * TILE_SIZE, WallType::STEEL)); } int wallDensityFactor = 28 + level * 2; int steelChance = 5 + level * 2; int waterChance = 3 + level * 2; int bushChance = (level >= 2) ? (level * 3) : 0; for (int i = spawnRowTop + 1; i < baseRow; ++i) { for (int j = 1; j < MAP_WIDTH - 1; ++j) { if (isProtectedZone(i, j)) continue; int placeRoll = rng.next() % wallDensityFactor; if (placeRoll < 10) { int typeRoll = rng.next() % 100; WallType currentType; bool placed = false; if (typeRoll < waterChance) { currentType = WallType::WATER; placed = true; } else if (typeRoll < waterChance + steelChance) { currentType = WallType::STEEL; placed = true; } else if (bushChance > 0 && typeRoll < waterChance + steelChance + bushChance) { currentType = WallType::BUSH; placed = true; } else { currentType = WallType::BRICK; placed = true; } if (placed) { walls.push_back(Wall(j * TILE_SIZE, i * TILE_SIZE, currentType)); } if (currentType != WallType::BUSH) { if (level > 2 && rng.next() % max(1, 8 - level + 1) == 0) { if (j + 1 < MAP_WIDTH - 1 && !isProtectedZone(i, j + 1)) walls.push_back(Wall((j + 1) * TILE_SIZE, i * TILE_SIZE, WallType::BRICK)); } if (level > 3 && rng.next() % max(1, 9 - level + 1) == 0) { if (i + 1 < baseRow && !isProtectedZone(i + 1, j)) walls.push_back(Wall(j * TILE_SIZE, (i + 1) * TILE_SIZE, WallType::BRICK)); } } } } } if (level >= 3) { for(int i=4; i<7; ++i) for(int j=4; j<7; ++j) if(!isProtectedZone(i,j) && rng.next()%2==0) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::STEEL)); } if (level >= 4) { for(int i=MAP_HEIGHT-6; i<MAP_HEIGHT-3; ++i) for(int j=MAP_WIDTH-7; j<MAP_WIDTH-4; ++j) if(!isProtectedZone(i,j) && rng.next()%2==0) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::WATER)); } if (level == 5) { for(int i = MAP_HEIGHT/2 - 1; i <= MAP_HEIGHT/2 + 1; ++i ) { for (int j = MAP_WIDTH/2 - 2; j <= MAP_WIDTH/2 + 2; ++j) { if (i == MAP_HEIGHT/2 && j == MAP_WIDTH/2) continue; if (!isProtectedZone(i,j)) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::STEEL)); } } } if (level >= 2 && level < 5) { for(int i = MAP_HEIGHT/2 - 2; i <= MAP_HEIGHT/2 + 2; ++i ) { for (int j = MAP_WIDTH/2 - 3; j <= MAP_WIDTH/2 + 3; ++j) { if (abs(i - MAP_HEIGHT/2) <=1 && abs(j-MAP_WIDTH/2) <=1) continue; if (!isProtectedZone(i,j) && rng.next()%4 == 0) { bool occupied = false; for(const auto& w : walls) { if (w.rect.x == j*TILE_SIZE && w.rect.y == i*TILE_SIZE && w.type != WallType::BUSH) { occupied = true; break; } } if (!occupied) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::BUSH)); } } } } }
+
+// =============================================================================
+// == Kiểm Tra Liên Thông Và Sửa Bản Đồ ==
+// =============================================================================
+// Mỗi (màn, seed) sinh ra đúng một bản đồ. Bản đồ hợp lệ khi cả ba ô sinh địch và ô xuất phát của
+// người chơi 2 đi tới được ô xuất phát của người chơi 1 mà không phải bắn vỡ gì (bụi cỏ đi xuyên
+// được). Bản đồ hỏng được sửa bằng cách gỡ ít ô chặn nhất có thể (0-1 BFS: ô chặn tốn 1, ô trống
+// tốn 0) trên đường nối vùng đã tới được với ô bị cô lập, nên địch không bị nhốt quanh chỗ sinh.
+const int ENEMY_SPAWN_TILES[3][2] = {{1, 1}, {MAP_WIDTH / 2 - 1, 1}, {MAP_WIDTH - 2, 1}}; // {cột, hàng}
+const size_t LEVEL_MAP_CACHE_CAPACITY = 64;
+
+struct GeneratedMap {
+    int level = 0;
+    Uint32 seed = 0;
+    vector<Wall> walls;
+    int carvedWalls = 0; // Số tường bị gỡ khi sửa (0 = bản đồ sinh ra đã hợp lệ)
+    int openTiles = 0;   // Số ô đi tới được từ ô xuất phát của người chơi 1
+};
+
+// Bitboard các ô xe tăng đi được trong phần bên trong bản đồ
+void tankPassableRows(const TileGrid& terrain, Uint64 pass[MAP_HEIGHT]) {
+    const Uint64 interior = (((Uint64)1 << (MAP_WIDTH - 1)) - 1) & ~(Uint64)1;
+    for (int r = 0; r < MAP_HEIGHT; ++r) pass[r] = (r == 0 || r == MAP_HEIGHT - 1) ? 0 : interior & ~terrain.tankBlockingRow(r);
+}
+
+// Loang trên bitboard từ ô (c, r): mỗi lượt lan cả hàng sang trái/phải bằng phép dịch bit,
+// rồi sang hàng trên/dưới, cho tới khi không còn ô mới
+void floodFillRows(const Uint64 pass[MAP_HEIGHT], int c, int r, Uint64 reach[MAP_HEIGHT]) {
+    memset(reach, 0, sizeof(Uint64) * MAP_HEIGHT);
+    reach[r] = ((Uint64)1 << c) & pass[r];
+    for (bool changed = (reach[r] != 0); changed; ) {
+        changed = false;
+        for (int row = 0; row < MAP_HEIGHT; ++row) {
+            Uint64 x = reach[row];
+            if (row > 0) x |= reach[row - 1] & pass[row];
+            if (row + 1 < MAP_HEIGHT) x |= reach[row + 1] & pass[row];
+            if (!x) continue;
+            for (Uint64 prev = 0; prev != x; ) { prev = x; x |= ((x << 1) | (x >> 1)) & pass[row]; }
+            if (x != reach[row]) { reach[row] = x; changed = true; }
+        }
+    }
+}
+
+// Đường ít ô chặn nhất từ vùng reach tới (c, r); bật bit các ô chặn cần gỡ vào carve.
+// Mọi bộ đệm nằm trên stack: hàng đợi hai đầu là vòng đệm, mỗi ô vào hàng đợi tối đa ba lần
+// (một lần đầu, rồi giá chỉ hạ được hai lần vì trong hàng đợi chỉ có hai mức giá d và d + 1).
+void cheapestCarvePath(const Uint64 pass[MAP_HEIGHT], const Uint64 reach[MAP_HEIGHT], int c, int r, Uint64 carve[MAP_HEIGHT]) {
+    static const int UNSEEN = INT_MAX, TILES = MAP_WIDTH * MAP_HEIGHT, OPEN_SLOTS = 4 * TILES;
+    int cost[TILES], parent[TILES], open[OPEN_SLOTS];
+    std::fill(cost, cost + TILES, UNSEEN); std::fill(parent, parent + TILES, -1);
+    int head = 0, size = 0;
+    auto pushFront = [&](int tile) { head = (head + OPEN_SLOTS - 1) % OPEN_SLOTS; open[head] = tile; ++size; };
+    auto pushBack = [&](int tile) { open[(head + size) % OPEN_SLOTS] = tile; ++size; };
+    for (int row = 1; row < MAP_HEIGHT - 1; ++row)
+        for (int col = 1; col < MAP_WIDTH - 1; ++col)
+            if (reach[row] & ((Uint64)1 << col)) { cost[row * MAP_WIDTH + col] = 0; pushBack(row * MAP_WIDTH + col); }
+    const int goal = r * MAP_WIDTH + c;
+    while (size > 0) {
+        int cur = open[head]; head = (head + 1) % OPEN_SLOTS; --size;
+        if (cur == goal) break;
+        int col = cur % MAP_WIDTH, row = cur / MAP_WIDTH;
+        for (int d = 0; d < 4; ++d) {
+            int nc = col + FLOW_DX[d], nr = row + FLOW_DY[d];
+            if (nc < 1 || nc > MAP_WIDTH - 2 || nr < 1 || nr > MAP_HEIGHT - 2) continue;
+            int step = (pass[nr] & ((Uint64)1 << nc)) ? 0 : 1, next = nr * MAP_WIDTH + nc;
+            if (cost[cur] + step >= cost[next]) continue;
+            cost[next] = cost[cur] + step; parent[next] = cur;
+            if (step) pushBack(next); else pushFront(next);
+        }
+    }
+    memset(carve, 0, sizeof(Uint64) * MAP_HEIGHT);
+    for (int cur = goal; cur >= 0 && cost[cur] > 0; cur = parent[cur])
+        if (!(pass[cur / MAP_WIDTH] & ((Uint64)1 << (cur % MAP_WIDTH)))) carve[cur / MAP_WIDTH] |= (Uint64)1 << (cur % MAP_WIDTH);
+}
+
+// Gỡ mọi tường thuộc các loại trong mask ở các ô có bit bật trong tiles (bitboard theo hàng)
+int removeWallsAt(vector<Wall>& walls, const Uint64 tiles[MAP_HEIGHT], unsigned typeMask) {
+    size_t before = walls.size();
+    walls.erase(std::remove_if(walls.begin(), walls.end(), [&](const Wall& w) {
+        return (typeMask & (1u << (int)w.type)) && (tiles[w.y / TILE_SIZE] >> (w.x / TILE_SIZE) & 1);
+    }), walls.end());
+    return (int)(before - walls.size());
+}
+
+// Sửa walls tại chỗ cho tới khi hợp lệ (không cấp phát); cộng số tường bị gỡ vào carvedWalls, trả về số ô đi tới được
+int validateAndRepairWalls(vector<Wall>& walls, int& carvedWalls) {
+    const unsigned TANK_BLOCKING = (1u << (int)WallType::BRICK) | (1u << (int)WallType::STEEL) | (1u << (int)WallType::WATER);
+    const int baseC = PLAYER1_START_X / TILE_SIZE, baseR = PLAYER_START_Y / TILE_SIZE;
+    int targets[4][2] = {{ENEMY_SPAWN_TILES[0][0], ENEMY_SPAWN_TILES[0][1]}, {ENEMY_SPAWN_TILES[1][0], ENEMY_SPAWN_TILES[1][1]},
+                         {ENEMY_SPAWN_TILES[2][0], ENEMY_SPAWN_TILES[2][1]}, {PLAYER2_START_X / TILE_SIZE, PLAYER_START_Y / TILE_SIZE}};
+    TileGrid terrain; Uint64 pass[MAP_HEIGHT], reach[MAP_HEIGHT], carve[MAP_HEIGHT];
+    for (;;) {
+        terrain.build(walls);
+        tankPassableRows(terrain, pass);
+        if (!(pass[baseR] & ((Uint64)1 << baseC))) {
+            memset(carve, 0, sizeof(carve)); carve[baseR] = (Uint64)1 << baseC;
+            carvedWalls += removeWallsAt(walls, carve, TANK_BLOCKING); continue;
+        }
+        floodFillRows(pass, baseC, baseR, reach);
+        int isolated = -1;
+        for (int t = 0; t < 4 && isolated < 0; ++t) if (!(reach[targets[t][1]] & ((Uint64)1 << targets[t][0]))) isolated = t;
+        if (isolated < 0) break;
+        cheapestCarvePath(pass, reach, targets[isolated][0], targets[isolated][1], carve);
+        carvedWalls += removeWallsAt(walls, carve, TANK_BLOCKING);
+    }
+    int openTiles = 0;
+    for (int r = 0; r < MAP_HEIGHT; ++r) openTiles += (int)std::bitset<64>(reach[r]).count();
+    return openTiles;
+}
+
+void validateAndRepairMap(GeneratedMap& map) { map.openTiles = validateAndRepairWalls(map.walls, map.carvedWalls); }
+
+GeneratedMap generateLevelMap(int level, Uint32 seed) {
+    GeneratedMap map; map.level = level; map.seed = seed;
+    LevelRng rng(seed);
+    generateWalls(level, rng, map.walls);
+    validateAndRepairMap(map);
+    return map;
+}
+
+// Bộ đệm bản đồ đã kiểm tra theo (màn, seed), dùng chung giữa luồng chính và luồng dựng màn.
+// Đầy thì bỏ bản đồ cũ nhất; bản đồ đã trả ra vẫn sống nhờ shared_ptr.
+class LevelMapCache {
+public:
+    static LevelMapCache& instance() { static LevelMapCache cache; return cache; }
+
+    std::shared_ptr<const GeneratedMap> get(int level, Uint32 seed) {
+        const Uint64 key = ((Uint64)(Uint32)level << 32) | seed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = maps.find(key);
+            if (it != maps.end()) return it->second;
+        }
+        auto map = std::make_shared<const GeneratedMap>(generateLevelMap(level, seed)); // Sinh ngoài khóa
+        std::lock_guard<std::mutex> lock(mutex);
+        auto inserted = maps.emplace(key, map);
+        if (!inserted.second) return inserted.first->second; // Luồng khác vừa sinh cùng bản đồ
+        order.push_back(key);
+        if (order.size() > LEVEL_MAP_CACHE_CAPACITY) { maps.erase(order.front()); order.pop_front(); }
+        return map;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<Uint64, std::shared_ptr<const GeneratedMap>> maps;
+    std::deque<Uint64> order; // Thứ tự thêm vào
+};
+
+struct LevelPlan {
+    int level = 0;
+    Uint32 seed = 0;
+    vector<Wall> walls;
+    TileGrid terrain;
+    SightLines sight;
+    FlowField playerFlow[2]; // Tới ô xuất phát của người chơi 1/2
+    int enemiesToSpawn = 0, maxEnemiesOnScreen = 0, toughEnemies = 0;
+};
+
+// Phần suy ra từ plan.walls: bitboard, tầm nhìn, trường hướng và số địch của màn
+void finishLevelPlan(LevelPlan& plan) {
+    const int level = plan.level;
+    plan.terrain.build(plan.walls);
+    plan.sight.build(plan.terrain);
+    plan.playerFlow[0].retarget(plan.terrain, PLAYER1_START_X / TILE_SIZE, PLAYER_START_Y / TILE_SIZE);
+    plan.playerFlow[1].retarget(plan.terrain, PLAYER2_START_X / TILE_SIZE, PLAYER_START_Y / TILE_SIZE);
+    if (level==1) plan.enemiesToSpawn=10; else if (level==2) plan.enemiesToSpawn=15; else if (level==3) plan.enemiesToSpawn=20; else if (level==4) plan.enemiesToSpawn=25; else if (level==5) plan.enemiesToSpawn=30; else plan.enemiesToSpawn=30+(level-5)*5;
+    if (level==1) plan.maxEnemiesOnScreen=4; else if (level<=3) plan.maxEnemiesOnScreen=5; else plan.maxEnemiesOnScreen=6+(level-5)/2;
+    if (level==1) plan.toughEnemies=0; else if (level==2) plan.toughEnemies=1; else if (level==3) plan.toughEnemies=3; else if (level==4) plan.toughEnemies=7; else if (level==5) plan.toughEnemies=10; else plan.toughEnemies=10+(level-5)*2;
+}
+
+LevelPlan buildLevelPlan(int level, Uint32 seed) {
+    LevelPlan plan; plan.level = level; plan.seed = seed;
+    std::shared_ptr<const GeneratedMap> map = LevelMapCache::instance().get(level, seed);
+    if (map->carvedWalls > 0) LOG_DEBUG("Level %d seed %u: removed %d walls to connect spawns.", level, seed, map->carvedWalls);
+    plan.walls = map->walls;
+    finishLevelPlan(plan);
+    return plan;
+}
+
+// Dựng lại plan có sẵn cho (màn, seed) mới: bản đồ sinh thẳng vào plan.walls (không qua LevelMapCache),
+// nên khi các bộ đệm đã đủ sức chứa thì không cấp phát gì. Cùng (màn, seed) cho cùng kết quả như buildLevelPlan().
+void rebuildLevelPlan(LevelPlan& plan, int level, Uint32 seed) {
+    plan.level = level; plan.seed = seed;
+    for (auto& f : plan.playerFlow) f.invalidate(); // Cùng ô đích với màn cũ nhưng địa hình đã khác
+    LevelRng rng(seed);
+    generateWalls(level, rng, plan.walls);
+    int carvedWalls = 0;
+    validateAndRepairWalls(plan.walls, carvedWalls);
+    if (carvedWalls > 0) LOG_DEBUG("Level %d seed %u: removed %d walls to connect spawns.", level, seed, carvedWalls);
+    finishLevelPlan(plan);
+}
+
+const int LEVEL_CLEAR_TICKS = 2500 * TICKS_PER_SECOND / 1000; // Màn "LEVEL CLEARED" trước khi vào màn mới
+const int VICTORY_TICKS = 3000 * TICKS_PER_SECOND / 1000;     // Màn chúc mừng trước khi thoát
+
+// =============================================================================
+// == RNG Của Trận Và Ghi/Phát Lại Đầu Vào (Replay) ==
+// =============================================================================
+// Mọi số ngẫu nhiên của mô phỏng lấy từ SimRng của Game, mọi mốc thời gian là số tick, và bàn phím
+// chỉ được đọc qua một mặt nạ bit mỗi tick cho mỗi người chơi. Vậy một trận được xác định hoàn toàn
+// bởi (trạng thái RNG lúc bắt đầu, số người chơi, màn, map seed, dãy mặt nạ). File ghi lưu dãy đó
+// dạng run-length (4 byte mỗi lần đầu vào đổi) cùng mã băm trạng thái cuối; --replay chạy lại
+// không giao diện, hết tốc độ, và so mã băm để báo phát lại có khớp không.
+struct SimRng {
+    Uint64 state = 0x853C49E6748FEA9BULL;
+    void seed(Uint64 s) { state = s; }
+    Uint32 next() { // splitmix64
+        Uint64 z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return (Uint32)((z ^ (z >> 31)) >> 32);
+    }
+    int below(int n) { return (int)(next() % (Uint32)n); }
+};
+
+// Mặt nạ đầu vào của một người chơi trong một tick; hai người chơi ghép thành Uint16 (P2 ở byte cao)
+const Uint8 INPUT_UP = 1, INPUT_DOWN = 2, INPUT_LEFT = 4, INPUT_RIGHT = 8;
+const Uint8 INPUT_FIRE = 16; // Chỉ bật ở tick có lần nhấn bắn mới
+const Uint8 INPUT_DIRECTIONS = INPUT_UP | INPUT_DOWN | INPUT_LEFT | INPUT_RIGHT;
+
+const char REPLAY_MAGIC[8] = {'B', 'C', 'R', 'E', 'P', 'L', 'A', 'Y'};
+const Uint32 REPLAY_VERSION = 5;
+
+struct ReplayHeader {
+    char magic[8];
+    Uint32 version;
+    Uint32 players, startLevel, mapSeed;
+    Uint64 rngState;   // SimRng lúc bắt đầu trận
+    Uint32 tickCount;  // Số tick đã ghi (kể cả tick chuyển màn)
+    Uint32 runCount;
+    Uint64 finalHash;  // Game::stateHash() sau tick cuối
+};
+
+struct InputRun { Uint16 input; Uint16 length; };
+
+class InputRecording {
+public:
+    ReplayHeader header;
+    vector<InputRun> runs;
+
+    InputRecording() { begin(1, 1, 0, 0); }
+
+    void begin(int players, int startLevel, Uint32 mapSeed, Uint64 rngState) {
+        memset(&header, 0, sizeof(header)); memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+        header.version = REPLAY_VERSION; header.players = (Uint32)players; header.startLevel = (Uint32)startLevel;
+        header.mapSeed = mapSeed; header.rngState = rngState;
+        runs.clear(); cursorRun = 0; cursorUsed = 0;
+    }
+
+    void push(Uint16 input) {
+        if (!runs.empty() && runs.back().input == input && runs.back().length < 0xFFFF) runs.back().length++;
+        else runs.push_back({input, 1});
+        header.tickCount++;
+    }
+
+    // Đọc tuần tự khi phát lại; hết dữ liệu thì trả 0 (không bấm gì)
+    Uint16 next() {
+        while (cursorRun < runs.size() && cursorUsed >= runs[cursorRun].length) { cursorRun++; cursorUsed = 0; }
+        if (cursorRun >= runs.size()) return 0;
+        cursorUsed++; return runs[cursorRun].input;
+    }
+
+    bool save(const char* path) {
+        header.runCount = (Uint32)runs.size();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)runs.data(), (std::streamsize)(runs.size() * sizeof(InputRun)));
+        return (bool)out;
+    }
+
+    bool load(const char* path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.read((char*)&header, sizeof(header))) return false;
+        if (memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0 || header.version != REPLAY_VERSION) return false;
+        runs.resize(header.runCount);
+        if (!in.read((char*)runs.data(), (std::streamsize)(runs.size() * sizeof(InputRun)))) return false;
+        cursorRun = 0; cursorUsed = 0;
+        return true;
+    }
+
+private:
+    size_t cursorRun = 0;
+    Uint32 cursorUsed = 0;
+};
+
+// =============================================================================
+// == Ảnh Chụp Trạng Thái Thế Giới (Snapshot) ==
+// =============================================================================
+// WorldSnapshot là một khối kích thước cố định, sao chép được bằng memcpy, chứa mọi thứ mô phỏng
+// cần để chạy tiếp: tường chỉ lưu (màn, map seed) cộng mặt nạ bit các bức tường đã vỡ, vì bản đồ
+// sinh lại được từ LevelMapCache. Những thứ suy ra được (bitboard, trường hướng, lưới địch, lớp vẽ)
+// được dựng lại khi khôi phục. Phần không dùng của các mảng luôn là 0, nên hai ảnh chụp liên tiếp
+// khác nhau rất ít byte: encodeSnapshotDelta chỉ ghi các đoạn word 8 byte bị đổi, vào vector của
+// người gọi (dùng lại giữa các khung, không cấp phát khi đã đủ dung lượng).
+const int SNAPSHOT_MAX_WALLS = 2048;
+const int SNAPSHOT_MAX_ENEMIES = 64;
+const int SNAPSHOT_MAX_BULLETS = 256;
+
+struct PlayerBotState { int prevX = -1, prevY = -1, wanderTicks = 0, wanderDirX = 0, wanderDirY = 0; };
+
+struct PlayerSnapshot {
+    Sint32 fx, fy, prevFx, prevFy, velocityX, velocityY;
+    Sint32 shotDelayCounter;
+    Sint8 lastDirX, lastDirY;
+    Uint8 isActive, padding;
+};
+
+struct EnemySnapshot {
+    Sint32 id, fx, fy, prevFx, prevFy, velocityX, velocityY;
+    Sint32 moveDecisionDelay, flowDetourTicks, shootDelay;
+    Uint32 hitStartTick, rngState;
+    Sint8 lastDirX, lastDirY;
+    Uint8 level, hitPoints, initialHitPoints, active, isHit, wantsToShoot;
+};
+
+struct BulletSnapshot { Sint32 fx, fy, prevFx, prevFy, dx, dy, owner; };
+
+struct alignas(8) WorldSnapshot {
+    Uint64 rngState;
+    Uint32 tick, lastSpawnTick;
+    Sint32 state, level, numberOfPlayers;
+    Uint32 mapSeed, pendingMapSeed;
+    Sint32 transitionTicks, transitionNextLevel;
+    Sint32 enemiesToSpawn, enemiesOnScreen, maxEnemiesOnScreen, toughToSpawn, toughSpawned, nextEnemyId;
+    PlayerBotState bots[2];
+    Uint8 matchOver, matchWon, appliedInput[2];
+    Uint16 wallCount, enemyCount, bulletCount, padding;
+    PlayerSnapshot players[2];
+    Uint8 destroyedWalls[SNAPSHOT_MAX_WALLS / 8]; // Bit i = walls[i] đã vỡ
+    Uint8 enemySlots[SNAPSHOT_MAX_ENEMIES];       // Slot của xe theo chỉ số dày đặc 0..enemyCount-1
+    EnemySnapshot enemies[SNAPSHOT_MAX_ENEMIES];  // Theo slot: xóa một xe không làm dời bản ghi của xe khác
+    BulletSnapshot bullets[SNAPSHOT_MAX_BULLETS];
+};
+static_assert(std::is_trivially_copyable<WorldSnapshot>::value, "WorldSnapshot phải sao chép được bằng memcpy");
+static_assert(sizeof(WorldSnapshot) / 8 <= 0xFFFF, "Độ dời trong delta là Uint16 (tính theo word)");
+
+const int SNAPSHOT_WORDS = (int)(sizeof(WorldSnapshot) / 8);
+
+// Delta = dãy đoạn [Uint16 số word bỏ qua][Uint16 số word đổi][các word mới], tính theo word 8 byte.
+// Chỉ mã hóa từ word startWord và không vượt maxBytes; trả về word phải mã hóa tiếp (SNAPSHOT_WORDS là
+// đã hết). Mỗi phần tự đứng được (độ dời đầu tính từ word 0), nên áp các phần của cùng một cặp
+// (gốc, hiện tại) theo thứ tự bất kỳ lên gốc cho cùng kết quả như một delta liền. maxBytes >= 12.
+int encodeSnapshotDelta(const WorldSnapshot& base, const WorldSnapshot& current, vector<Uint8>& out, int startWord = 0,
+                        size_t maxBytes = std::numeric_limits<size_t>::max()) {
+    const Uint8* a = (const Uint8*)&base; const Uint8* b = (const Uint8*)&current;
+    auto differs = [&](int w) { return memcmp(a + w * 8, b + w * 8, 8) != 0; };
+    out.clear();
+    int w = startWord, lastEnd = 0;
+    while (w < SNAPSHOT_WORDS) {
+        if (!differs(w)) { ++w; continue; }
+        int end = w + 1; // Nối các đoạn cách nhau một word: rẻ hơn 4 byte tiêu đề đoạn mới
+        while (end < SNAPSHOT_WORDS && (differs(end) || (end + 1 < SNAPSHOT_WORDS && differs(end + 1)))) ++end;
+        size_t room = maxBytes - out.size();
+        if (room < sizeof(Uint16) * 2 + 8) return w;                 // Hết chỗ: đoạn này sang phần sau
+        end = w + (int)min((size_t)(end - w), (room - sizeof(Uint16) * 2) / 8); // Cắt đoạn dài hơn chỗ còn lại
+        Uint16 header[2] = {(Uint16)(w - lastEnd), (Uint16)(end - w)};
+        out.insert(out.end(), (const Uint8*)header, (const Uint8*)header + sizeof(header));
+        out.insert(out.end(), b + w * 8, b + end * 8);
+        lastEnd = w = end;
+    }
+    return SNAPSHOT_WORDS;
+}
+
+// out = base + delta (out có thể là chính base); false nếu delta hỏng
+bool applySnapshotDelta(const WorldSnapshot& base, const Uint8* delta, size_t size, WorldSnapshot& out) {
+    const size_t WORDS = sizeof(WorldSnapshot) / 8;
+    if (&out != &base) memcpy(&out, &base, sizeof(WorldSnapshot));
+    Uint8* dst = (Uint8*)&out;
+    size_t pos = 0, word = 0;
+    while (pos < size) {
+        if (size - pos < 4) return false;
+        Uint16 header[2]; memcpy(header, delta + pos, sizeof(header)); pos += sizeof(header);
+        word += header[0];
+        if (word + header[1] > WORDS || size - pos < (size_t)header[1] * 8) return false;
+        memcpy(dst + word * 8, delta + pos, (size_t)header[1] * 8);
+        pos += (size_t)header[1] * 8; word += header[1];
+    }
+    return true;
+}
+
+// =============================================================================
+// == Mạng: Máy Chủ UDP Và Client Mỏng ==
+// =============================================================================
+// Máy chủ (--server) chạy Game không giao diện, là nơi duy nhất gọi Game::update() thật. Client
+// (--connect) mỗi tick gửi mặt nạ đầu vào của mình, kèm NET_INPUT_REDUNDANCY mặt nạ trước đó để
+// mất gói không mất lần bắn nào; máy chủ tiêu thụ đúng một mặt nạ mỗi tick theo số thứ tự. Mỗi tick
+// máy chủ gửi cho từng client delta của WorldSnapshot so với ảnh chụp client đã xác nhận (hoặc so
+// với ảnh chụp toàn 0 nếu chưa có, tức cả trạng thái), cắt thành các phần vừa một datagram; client
+// ghép đủ phần mới nhận khung và xác nhận nó. Client khôi phục ảnh chụp mới nhất rồi đoán
+// trước xe của mình bằng các mặt nạ máy chủ chưa xử lý. NetConditioner giả lập độ trễ/mất gói
+// ở phía gửi để đo băng thông và độ trễ đầu vào -> màn hình ngay trên localhost.
+const Uint16 NET_DEFAULT_PORT = 27960;
+const Uint32 NET_MAGIC = 0x324E4342;     // "BCN2"
+const int NET_MAX_DATAGRAM = 1200;       // Dưới MTU thông dụng, không bị phân mảnh
+const int NET_SNAPSHOT_MAX_PARTS = 16;   // Số datagram tối đa của một khung ảnh chụp
+const int NET_SNAPSHOT_HISTORY = 64;     // Số ảnh chụp gần nhất giữ lại làm gốc delta (khung)
+const int NET_INPUT_REDUNDANCY = 16;
+const int NET_INPUT_BUFFER_MAX = 6;      // Client chạy nhanh hơn máy chủ: bỏ bớt đầu vào tồn đọng
+const Uint32 NET_HELLO_INTERVAL_MS = 250;
+const Uint32 NET_TIMEOUT_MS = 5000;
+
+enum class NetPacket : Uint8 { HELLO = 1, WELCOME, INPUT, SNAPSHOT, BYE };
+
+#pragma pack(push, 1)
+struct NetHeader { Uint32 magic; NetPacket type; Uint8 slot; };
+struct NetWelcomePacket { NetHeader h; Uint8 players; };
+struct NetInputPacket {
+    NetHeader h;
+    Uint32 newestSeq;  // Số thứ tự của masks[0]; masks[i] là của newestSeq - i
+    Uint32 ackFrame;   // Khung ảnh chụp mới nhất client đã giải được
+    Uint8 count;
+    Uint8 masks[NET_INPUT_REDUNDANCY];
+};
+struct NetSnapshotPacket {
+    NetHeader h;
+    Uint32 frame, baseFrame; // baseFrame = 0: delta so với ảnh chụp toàn 0
+    Uint32 lastInputSeq;     // Đầu vào mới nhất của client này máy chủ đã áp dụng
+    Uint16 deltaSize;        // Theo sau là deltaSize byte delta (một phần tự đứng được, xem encodeSnapshotDelta)
+    Uint8 part, partCount;   // Phần thứ part trong partCount phần của khung
+};
+#pragma pack(pop)
+// Mỗi phần chưa cuối dùng ít nhất ngân sách - 11 byte và mỗi word nó phủ tốn tối đa 12 byte (đoạn một word)
+static_assert(NET_SNAPSHOT_MAX_PARTS * ((NET_MAX_DATAGRAM - (int)sizeof(NetSnapshotPacket) - 11) / 12) >= SNAPSHOT_WORDS,
+              "Ảnh chụp toàn phần phải vừa NET_SNAPSHOT_MAX_PARTS datagram");
+static_assert(NET_SNAPSHOT_MAX_PARTS <= 32, "Các phần đã nhận đánh dấu trong một Uint32");
+
+inline Uint32 netNowMs() {
+    return (Uint32)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class UdpSocket {
+public:
+    ~UdpSocket() { close(); }
+
+    // port = 0: cổng bất kỳ (client). Socket không chặn.
+    bool open(Uint16 port) {
+#if defined(_WIN32)
+        static const bool wsaReady = []() { WSADATA wsa; return WSAStartup(MAKEWORD(2, 2), &wsa) == 0; }(); // Khởi tạo một lần, an toàn đa luồng
+        if (!wsaReady) return false;
+#endif
+        handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (!valid()) return false;
+        sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET; addr.sin_addr.s_addr = htonl(INADDR_ANY); addr.sin_port = htons(port);
+        if (bind(handle, (sockaddr*)&addr, sizeof(addr)) != 0) { close(); return false; }
+#if defined(_WIN32)
+        u_long nonBlocking = 1; ioctlsocket(handle, FIONBIO, &nonBlocking);
+#else
+        fcntl(handle, F_SETFL, fcntl(handle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+        return true;
+    }
+
+    static bool resolve(const char* host, Uint16 port, sockaddr_in& out) {
+        addrinfo hints; memset(&hints, 0, sizeof(hints)); hints.ai_family = AF_INET; hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host, nullptr, &hints, &found) != 0 || !found) return false;
+        memcpy(&out, found->ai_addr, sizeof(out)); out.sin_port = htons(port);
+        freeaddrinfo(found);
+        return true;
+    }
+
+    // Số byte nhận được, -1 nếu không còn gói nào
+    int receive(Uint8* buffer, int capacity, sockaddr_in& from) {
+        socklen_t fromLen = sizeof(from);
+        int n = (int)recvfrom(handle, (char*)buffer, capacity, 0, (sockaddr*)&from, &fromLen);
+        return n >= 0 ? n : -1;
+    }
+
+    void sendTo(const Uint8* data, int size, const sockaddr_in& to) { sendto(handle, (const char*)data, size, 0, (const sockaddr*)&to, sizeof(to)); }
+
+    // Cổng đã gắn (sau open(0) là cổng hệ điều hành chọn), 0 nếu lỗi
+    Uint16 localPort() const {
+        sockaddr_in addr; socklen_t len = sizeof(addr);
+        return getsockname(handle, (sockaddr*)&addr, &len) == 0 ? ntohs(addr.sin_port) : 0;
+    }
+
+    void close() {
+        if (!valid()) return;
+#if defined(_WIN32)
+        closesocket(handle); handle = INVALID_SOCKET;
+#else
+        ::close(handle); handle = -1;
+#endif
+    }
+
+private:
+#if defined(_WIN32)
+    SOCKET handle = INVALID_SOCKET;
+    bool valid() const { return handle != INVALID_SOCKET; }
+#else
+    int handle = -1;
+    bool valid() const { return handle >= 0; }
+#endif
+};
+
+inline bool sameAddress(const sockaddr_in& a, const sockaddr_in& b) { return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port; }
+
+// Giả lập đường truyền phía gửi: bỏ gói theo tỉ lệ, giữ gói lại latency ± jitter ms trong một vòng
+// ô cố định (không cấp phát). Gói đi ra có thể đảo thứ tự khi có jitter, như mạng thật.
+struct NetConditions { int latencyMs = 0, jitterMs = 0, lossPercent = 0; };
+
+class NetConditioner {
+public:
+    NetConditions conditions;
+    Uint64 bytesSent = 0, packetsSent = 0, packetsDropped = 0;
+
+    NetConditioner() { rng.seed(0xC0FFEE); }
+
+    void send(UdpSocket& socket, const Uint8* data, int size, const sockaddr_in& to) {
+        bytesSent += (Uint64)size + UDP_IP_OVERHEAD; packetsSent++;
+        if (conditions.lossPercent > 0 && rng.below(100) < conditions.lossPercent) { packetsDropped++; return; }
+        int delay = conditions.latencyMs + (conditions.jitterMs > 0 ? rng.below(2 * conditions.jitterMs + 1) - conditions.jitterMs : 0);
+        if (delay <= 0) { socket.sendTo(data, size, to); return; }
+        for (Slot& slot : slots) {
+            if (slot.used) continue;
+            slot.used = true; slot.releaseMs = netNowMs() + (Uint32)delay; slot.to = to; slot.size = size;
+            memcpy(slot.data, data, (size_t)size);
+            return;
+        }
+        packetsDropped++; // Hàng đợi giả lập đầy: coi như mất
+    }
+
+    void flush(UdpSocket& socket) {
+        Uint32 now = netNowMs();
+        for (Slot& slot : slots)
+            if (slot.used && (Sint32)(now - slot.releaseMs) >= 0) { socket.sendTo(slot.data, slot.size, slot.to); slot.used = false; }
+    }
+
+private:
+    static const int UDP_IP_OVERHEAD = 28; // Tính cả tiêu đề IPv4 + UDP vào băng thông
+    struct Slot { bool used = false; Uint32 releaseMs = 0; sockaddr_in to; int size = 0; Uint8 data[NET_MAX_DATAGRAM]; };
+    Slot slots[256];
+    SimRng rng;
+};
+
+// Trạng thái phía client: ảnh chụp đã nhận (gốc cho delta), đầu vào đã gửi và số đo
+class NetClient {
+public:
+    UdpSocket socket;
+    NetConditioner link;
+    sockaddr_in server;
+    int slot = -1, players = 0;
+    bool welcomed = false, serverClosed = false;
+    Uint32 lastHelloMs = 0, lastHeardMs = 0;
+
+    Uint32 inputSeq = 0;                   // Số thứ tự của mặt nạ gửi gần nhất
+    Uint8 sentMasks[NET_SNAPSHOT_HISTORY]; // Theo inputSeq % NET_SNAPSHOT_HISTORY
+    Uint32 sentMs[NET_SNAPSHOT_HISTORY];
+    Uint32 ackedInputSeq = 0;              // lastInputSeq của ảnh chụp mới nhất
+
+    std::unique_ptr<WorldSnapshot[]> snapshots{new WorldSnapshot[NET_SNAPSHOT_HISTORY]};
+    Uint32 snapshotFrame[NET_SNAPSHOT_HISTORY] = {};
+    Uint32 latestFrame = 0;
+
+    // Khung đang ghép từ các phần: gốc được chép vào assembly lúc nhận phần đầu tiên, mỗi phần áp lên đó.
+    // Chỉ ghép một khung một lúc; phần của khung mới hơn bỏ khung đang dở.
+    std::unique_ptr<WorldSnapshot> assembly{new WorldSnapshot};
+    Uint32 assemblyFrame = 0, assemblyBase = 0, assemblyParts = 0, partsReceived = 0;
+
+    // Số đo: byte nhận, số ảnh chụp, độ trễ từ lúc gửi một đầu vào tới lúc nhận ảnh chụp đã áp dụng nó
+    Uint64 bytesReceived = 0, snapshotsReceived = 0, snapshotsUndecodable = 0;
+    vector<Uint32> confirmDelayMs;
+    SimRng scriptRng; // Đầu vào tự động của client không giao diện
+    Uint8 scriptMask = 0; int scriptTicks = 0;
+
+    bool connect(const char* host, Uint16 port) {
+        if (!UdpSocket::resolve(host, port, server) || !socket.open(0)) return false;
+        memset((void*)snapshots.get(), 0, sizeof(WorldSnapshot) * NET_SNAPSHOT_HISTORY);
+        confirmDelayMs.reserve(1 << 16);
+        lastHeardMs = netNowMs();
+        return true;
+    }
+
+    void sendHello() {
+        NetHeader hello = {NET_MAGIC, NetPacket::HELLO, 0};
+        link.send(socket, (const Uint8*)&hello, sizeof(hello), server);
+        lastHelloMs = netNowMs();
+    }
+
+    void sendInput(Uint8 mask) {
+        inputSeq++;
+        sentMasks[inputSeq % NET_SNAPSHOT_HISTORY] = mask; sentMs[inputSeq % NET_SNAPSHOT_HISTORY] = netNowMs();
+        NetInputPacket packet; memset(&packet, 0, sizeof(packet));
+        packet.h = {NET_MAGIC, NetPacket::INPUT, (Uint8)slot};
+        packet.newestSeq = inputSeq; packet.ackFrame = latestFrame;
+        packet.count = (Uint8)min<Uint32>(inputSeq, NET_INPUT_REDUNDANCY);
+        for (int i = 0; i < packet.count; ++i) packet.masks[i] = sentMasks[(inputSeq - i) % NET_SNAPSHOT_HISTORY];
+        link.send(socket, (const Uint8*)&packet, sizeof(packet), server);
+    }
+
+    void sendBye() { NetHeader bye = {NET_MAGIC, NetPacket::BYE, (Uint8)slot}; socket.sendTo((const Uint8*)&bye, sizeof(bye), server); }
+
+    void poll() {
+        Uint8 buffer[NET_MAX_DATAGRAM]; sockaddr_in from;
+        link.flush(socket);
+        for (int n; (n = socket.receive(buffer, sizeof(buffer), from)) >= 0; ) {
+            if (n < (int)sizeof(NetHeader) || !sameAddress(from, server)) continue;
+            NetHeader h; memcpy(&h, buffer, sizeof(h));
+            if (h.magic != NET_MAGIC) continue;
+            bytesReceived += (Uint64)n + 28; lastHeardMs = netNowMs();
+            if (h.type == NetPacket::WELCOME && n >= (int)sizeof(NetWelcomePacket)) {
+                NetWelcomePacket w; memcpy(&w, buffer, sizeof(w));
+                if (!welcomed) LOG_INFO("Joined server as player %d of %d.", w.h.slot + 1, w.players);
+                welcomed = true; slot = w.h.slot; players = w.players;
+            } else if (h.type == NetPacket::SNAPSHOT && n >= (int)sizeof(NetSnapshotPacket)) {
+                NetSnapshotPacket sp; memcpy(&sp, buffer, sizeof(sp));
+                if ((int)sizeof(sp) + sp.deltaSize > n || sp.frame <= latestFrame) continue; // Cũ hoặc đảo thứ tự: bỏ
+                if (sp.partCount == 0 || sp.partCount > NET_SNAPSHOT_MAX_PARTS || sp.part >= sp.partCount) continue;
+                if (sp.frame != assemblyFrame) {
+                    if (sp.frame < assemblyFrame) continue; // Phần của khung cũ hơn khung đang ghép
+                    int baseIndex = sp.baseFrame % NET_SNAPSHOT_HISTORY;
+                    assemblyFrame = sp.frame; assemblyParts = 0; partsReceived = 0;
+                    if (sp.baseFrame && snapshotFrame[baseIndex] != sp.baseFrame) { snapshotsUndecodable++; continue; } // Gốc đã bị ghi đè
+                    memcpy((void*)assembly.get(), sp.baseFrame ? &snapshots[baseIndex] : zeroSnapshot(), sizeof(WorldSnapshot));
+                    assemblyBase = sp.baseFrame; assemblyParts = sp.partCount;
+                }
+                if (sp.baseFrame != assemblyBase || sp.partCount != assemblyParts || (partsReceived >> sp.part & 1)) continue;
+                if (!applySnapshotDelta(*assembly, buffer + sizeof(sp), sp.deltaSize, *assembly)) { snapshotsUndecodable++; assemblyParts = 0; continue; }
+                partsReceived |= 1u << sp.part;
+                if (partsReceived != (1u << assemblyParts) - 1) continue; // Còn chờ phần khác
+                snapshotsReceived++;
+                int index = sp.frame % NET_SNAPSHOT_HISTORY;
+                memcpy((void*)&snapshots[index], assembly.get(), sizeof(WorldSnapshot));
+                snapshotFrame[index] = sp.frame; latestFrame = sp.frame;
+                for (Uint32 seq = ackedInputSeq + 1; seq <= sp.lastInputSeq && seq <= inputSeq; ++seq)
+                    if (inputSeq - seq < NET_SNAPSHOT_HISTORY) confirmDelayMs.push_back(netNowMs() - sentMs[seq % NET_SNAPSHOT_HISTORY]);
+                if (sp.lastInputSeq > ackedInputSeq) ackedInputSeq = sp.lastInputSeq;
+            } else if (h.type == NetPacket::BYE) {
+                serverClosed = true;
+            }
+        }
+    }
+
+    const WorldSnapshot& latest() const { return snapshots[latestFrame % NET_SNAPSHOT_HISTORY]; }
+
+    // Đầu vào kiểu người chơi ngẫu nhiên cho client không giao diện: giữ một hướng vài chục tick, thỉnh thoảng bắn
+    Uint8 scriptedInput() {
+        if (--scriptTicks <= 0) { scriptTicks = 15 + scriptRng.below(60); scriptMask = (Uint8)(1 << scriptRng.below(5)) & INPUT_DIRECTIONS; }
+        return (Uint8)(scriptMask | (scriptRng.below(20) == 0 ? INPUT_FIRE : 0));
+    }
+
+    static const WorldSnapshot* zeroSnapshot() {
+        static const std::unique_ptr<WorldSnapshot> zero = []() {
+            std::unique_ptr<WorldSnapshot> s(new WorldSnapshot); memset((void*)s.get(), 0, sizeof(WorldSnapshot)); return s;
+        }();
+        return zero.get();
+    }
+};
+
+// =============================================================================
+// == Lớp WorkerPool (Nhóm luồng cố định) ==
+// =============================================================================
+// Các luồng được tạo một lần và ngủ giữa các lần run(), nên chia việc mỗi tick không phải tạo luồng.
+// run() giao chỉ số qua một bộ đếm nguyên tử, luồng gọi cũng làm việc, và chỉ trả về khi xong hết.
+class WorkerPool {
+public:
+    explicit WorkerPool(int workerThreads) {
+        for (int t = 0; t < workerThreads; ++t) threads.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~WorkerPool() {
+        { std::lock_guard<std::mutex> lock(mutex); stopping = true; }
+        wake.notify_all();
+        for (auto& th : threads) th.join();
+    }
+
+    template <class F> void run(int count, F& fn) {
+        if (threads.empty() || count <= 1) { for (int i = 0; i < count; ++i) fn(i); return; }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn; invoke = [](void* f, int i) { (*(F*)f)(i); };
+            jobCount = count; next = 0; busyWorkers = (int)threads.size(); ++generation;
+        }
+        wake.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return busyWorkers == 0; });
+    }
+
+private:
+    vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    void* job = nullptr;
+    void (*invoke)(void*, int) = nullptr;
+    int jobCount = 0, busyWorkers = 0;
+    std::atomic<int> next{0};
+    Uint64 generation = 0;
+    bool stopping = false;
+
+    void drain() { for (int i = next++; i < jobCount; i = next++) invoke(job, i); }
+
+    void workerLoop() {
+        Uint64 seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            drain();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) done.notify_one();
+        }
+    }
+};
+
+// Dưới ngưỡng này pha AI chạy trên luồng chính: chi phí đánh thức luồng lớn hơn phần việc
+const int PARALLEL_AI_MIN_ENEMIES = 8;
+
+// =============================================================================
+// == Lớp StealingScheduler (Chia việc dài có lấy trộm) ==
+// =============================================================================
+// Cho việc chạy theo từng lát (vd. mỗi trận vài chục tick một lần): mỗi luồng có hàng đợi riêng, lấy
+// việc ở đầu và xếp việc chưa xong lại cuối, nên các việc của một luồng thay nhau tiến lên. Hàng đợi
+// của mình rỗng thì lấy trộm việc ở cuối hàng đợi luồng khác, nên việc dài/ngắn không đều (trận thua
+// sớm, trận kéo tới màn 5) không để luồng nào ngồi không. Khóa chỉ giữ lúc đẩy/lấy một chỉ số.
+class StealingScheduler {
+public:
+    Uint64 steals = 0;
+
+    // Chạy step(worker, id) cho tới khi mọi id trong [0, count) trả về false (false = việc đã xong)
+    template <class F> void run(int workers, int count, F step) {
+        workers = max(1, min(workers, count));
+        std::unique_ptr<Queue[]> queues(new Queue[workers]);
+        for (int i = 0; i < count; ++i) queues[i % workers].items.push_back(i);
+        std::atomic<int> remaining(count);
+        std::atomic<Uint64> stolen(0);
+        auto work = [&](int w) {
+            Queue& own = queues[w];
+            while (remaining.load(std::memory_order_acquire) > 0) {
+                int id = own.popFront();
+                for (int k = 1; id < 0 && k < workers; ++k) if ((id = queues[(w + k) % workers].popBack()) >= 0) stolen++;
+                if (id < 0) { std::this_thread::yield(); continue; } // Việc còn lại đang chạy trên luồng khác
+                if (step(w, id)) own.pushBack(id); else remaining.fetch_sub(1, std::memory_order_release);
+            }
+        };
+        vector<std::thread> threads;
+        for (int w = 1; w < workers; ++w) threads.emplace_back(work, w);
+        work(0);
+        for (auto& th : threads) th.join();
+        steals += stolen.load();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> items;
+        int popFront() { std::lock_guard<std::mutex> lock(mutex); if (items.empty()) return -1; int id = items.front(); items.pop_front(); return id; }
+        int popBack() { std::lock_guard<std::mutex> lock(mutex); if (items.empty()) return -1; int id = items.back(); items.pop_back(); return id; }
+        void pushBack(int id) { std::lock_guard<std::mutex> lock(mutex); items.push_back(id); }
+    };
+};
+
+// =============================================================================
+// == Lớp SoundBoard (Hàng đợi sự kiện âm thanh và quản lý kênh) ==
+// =============================================================================
+// Mô phỏng chỉ gửi sự kiện (post); cuối mỗi tick flush() gộp các sự kiện cùng loại thành một tiếng,
+// xử lý sự kiện của người chơi trước, và phát trong nhóm kênh riêng của âm thanh đó (SDL_mixer
+// channel group) nên một loại không chiếm hết kênh của loại khác. Nhóm đầy thì sự kiện người chơi
+// lấy kênh phát lâu nhất, còn sự kiện của địch bị bỏ; địch cũng không được lặp lại cùng tiếng nhanh
+// hơn minIntervalTicks. Không mở mixer (headless, máy chủ) thì post() không làm gì.
+enum class SoundId : Uint8 { BULLET_SHOT, TANK_BROKEN, LEVEL_UP, PLAYER_DESTROYED, COUNT };
+
+struct SoundVoiceSpec { int voices; int minIntervalTicks; };
+const SoundVoiceSpec SOUND_VOICES[(int)SoundId::COUNT] = {
+    {4, 4}, // BULLET_SHOT
+    {3, 2}, // TANK_BROKEN
+    {1, 0}, // LEVEL_UP
+    {2, 0}, // PLAYER_DESTROYED
+};
+
+class SoundBoard {
+public:
+    Mix_Chunk* chunks[(int)SoundId::COUNT] = {}; // PLAYER_DESTROYED dùng chung chunk với TANK_BROKEN
+    Uint64 posted = 0, played = 0, coalesced = 0, rateLimited = 0, dropped = 0, stolen = 0;
+
+    // Gọi sau Mix_OpenAudio: mỗi âm thanh một nhóm kênh, số kênh = số tiếng tối đa cùng lúc
+    void open() {
+        int first = 0;
+        for (int i = 0; i < (int)SoundId::COUNT; ++i) first += SOUND_VOICES[i].voices;
+        Mix_AllocateChannels(first);
+        first = 0;
+        for (int i = 0; i < (int)SoundId::COUNT; ++i) { Mix_GroupChannels(first, first + SOUND_VOICES[i].voices - 1, i); first += SOUND_VOICES[i].voices; }
+        enabled = true;
+    }
+
+    void freeChunks() {
+        for (int i = 0; i < (int)SoundId::COUNT; ++i) if (chunks[i] && i != (int)SoundId::PLAYER_DESTROYED) Mix_FreeChunk(chunks[i]);
+        memset(chunks, 0, sizeof(chunks)); enabled = false;
+    }
+
+    void post(SoundId id, bool fromPlayer) {
+        if (!enabled) return;
+        Pending& p = pending[(int)id];
+        if (p.count++) coalesced++;
+        p.player |= fromPlayer; posted++;
+    }
+
+    void flush() {
+        if (!enabled) return;
+        frame++;
+        for (int pass = 0; pass < 2; ++pass) // Lượt 0: sự kiện có phần của người chơi
+            for (int i = 0; i < (int)SoundId::COUNT; ++i)
+                if (pending[i].count && pending[i].player == (pass == 0)) play(i, pending[i].player);
+        memset(pending, 0, sizeof(pending));
+    }
+
+private:
+    struct Pending { int count; bool player; };
+    Pending pending[(int)SoundId::COUNT] = {};
+    Uint32 lastPlayed[(int)SoundId::COUNT] = {};
+    Uint32 frame = 0;
+    bool enabled = false;
+
+    void play(int id, bool player) {
+        if (!chunks[id]) return;
+        if (!player && lastPlayed[id] && frame - lastPlayed[id] < (Uint32)SOUND_VOICES[id].minIntervalTicks) { rateLimited++; return; }
+        int channel = Mix_GroupAvailable(id);
+        if (channel < 0 && player) { channel = Mix_GroupOldest(id); if (channel >= 0) stolen++; }
+        if (channel < 0) { dropped++; return; }
+        if (Mix_PlayChannel(channel, chunks[id], 0) >= 0) { played++; lastPlayed[id] = frame; }
+    }
+};
+
+// =============================================================================
+// == Lớp Game (Quản lý chính) ==
+// =============================================================================
+class Game {
+public:
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    bool running = true;
+    GameState currentState = GameState::SELECT_MODE;
+    int numberOfPlayers = 1;
+    vector<Wall> walls;
+    TileGrid terrain; // Bitboard chiếm chỗ của walls, đồng bộ khi gạch vỡ
+    SightLines sight; // Tầm bắn theo hàng/cột dựng từ terrain, dùng cho quyết định bắn của địch
+    SpatialGrid enemyGrid; // Broadphase xe tăng địch, dựng lại đầu mỗi tick
+    vector<SDL_Rect> enemyRects; // Ảnh chụp rect xe địch theo slot: pha AI chỉ đọc, pha áp dụng cập nhật khi từng xe di chuyển
+    std::unique_ptr<WorkerPool> aiWorkers; // nullptr: pha AI chạy tuần tự (kết quả như nhau)
+    FlowField playerFlow[2]; // Trường hướng BFS tới người chơi 1/2, dùng chung cho mọi xe tăng địch
+    BulletPool bullets;    // Đạn của tất cả xe tăng
+    int nextEnemyId = 0;
+    PlayerTank player1;
     PlayerTank player2;
-    vector<EnemyTank> enemies;
+    EnemyStore enemies;
     int enemiesToSpawn = 0;
     int enemiesOnScreen = 0;
     int maxEnemiesOnScreen = 4;
@@ -464,396 +2362,2015 @@ public:
     const int maxLevels = 5;
     int toughEnemiesToSpawnThisLevel = 0;
     int toughEnemiesSpawnedThisLevel = 0;
+    Uint32 fixedMapSeed = 0;             // Khác 0: mọi màn dùng bản đồ của seed này (--map-seed)
+    Uint32 currentMapSeed = 0;           // Map seed của màn đang chơi (ảnh chụp lưu cái này thay cho tường)
+    Uint32 pendingMapSeed = 0;           // Map seed của màn đang dựng trên luồng nền
+    std::future<LevelPlan> pendingLevel; // Màn kế tiếp đang được dựng trên luồng nền
+    LevelPlan levelScratch;              // Bộ đệm dùng lại của setupLevel()
+    int transitionTicks = 0;             // Số tick còn lại của màn chuyển tiếp
+    int transitionNextLevel = 0;         // 0: đã thắng màn cuối, hết chuyển tiếp thì thoát
+
+    // Chế độ mô phỏng không giao diện (headless) và trận AI-vs-AI
+    bool headless = false;      // Không tạo cửa sổ, renderer, texture, mixer
+    bool autoPlayers = false;   // Người chơi do bot điều khiển thay cho bàn phím
+    bool matchOver = false;     // Trận đã kết thúc (thua hoặc thắng màn cuối)
+    bool matchWon = false;
+    bool instantTransitions = false; // Qua màn ngay trong cùng tick (headless), không có màn chuyển tiếp
+    Uint32 tick = 0;            // Đồng hồ mô phỏng: số tick PLAYING từ đầu trận
+    Uint32 lastSpawnTick = 0;   // Tick của lần sinh địch gần nhất
+    Uint32 enemiesDestroyed = 0, playerHits = 0; // Đếm từ đầu trận (phần thưởng của VecEnv)
+    SimRng rng;                 // Nguồn ngẫu nhiên duy nhất của mô phỏng
+
+    // Bàn phím -> mặt nạ đầu vào mỗi tick (xem INPUT_*), kèm ghi/phát lại
+    Uint8 heldInput[2] = {};    // Phím hướng đang giữ
+    Uint8 tappedInput[2] = {};  // Phím nhấn từ tick trước (giữ được cả lần nhấn-nhả lọt giữa hai tick)
+    Uint8 appliedInput[2] = {}; // Mặt nạ hướng đã áp dụng ở tick trước, để tìm cạnh nhấn/nhả
+    const char* recordPath = nullptr; // Khác null: ghi trận vào file này (--record)
+    bool recording = false;
+    InputRecording inputLog;
+    InputRecording* replayInput = nullptr; // Khác null: lấy đầu vào từ bản ghi thay cho bàn phím
+    std::unique_ptr<WorldSnapshot> quickSave; // F5 lưu nhanh, F9 nạp lại
+    PlayerBotState bot1, bot2;
+
+    // Chơi qua mạng (xem phần Mạng)
+    bool useNetworkInput = false; // Máy chủ: đầu vào của tick lấy từ networkInput thay cho bàn phím
+    Uint16 networkInput = 0;
+    NetClient* netClient = nullptr; // Khác null: client mỏng, chỉ gửi đầu vào và vẽ trạng thái nhận được
+
+    // Textures
+    SDL_Texture* menuTexture = nullptr;
+    SpriteAtlas sprites; // Xe tăng, đạn, ô địa hình
+    SpriteBatch batch;
+    SDL_Texture* gameOverTexture = nullptr;
+
+    // Lớp địa hình dựng sẵn (render target): vẽ lại toàn bộ một lần mỗi màn, sau đó chỉ vá các ô gạch vừa vỡ
+    SDL_Texture* terrainLayer = nullptr; // Nền + gạch/thép/nước (đục)
+    SDL_Texture* bushLayer = nullptr;    // Bụi cỏ (trong suốt), vẽ đè sau cùng
+    bool terrainCacheValid = false;
+    Uint64 dirtyTerrainRows[MAP_HEIGHT] = {}; // Bit c của hàng r = ô (r,c) cần vẽ lại
+
+    // Bộ đo khung hình: luôn ghi ở chế độ cửa sổ (F3 bật/tắt overlay, F4 xuất trace)
+    Profiler profiler;
+    bool profilerOverlay = false;
+    vector<SDL_Rect> overlayRects; // Dùng lại giữa các khung khi vẽ overlay
+
+    // Sounds
+    bool audioOpen = false;
+    AssetBundle assets;                 // Gói tài nguyên đã mmap; phải sống lâu hơn các surface/chunk trỏ vào nó
+    vector<vector<Uint8>> soundBuffers; // PCM tự giải mã khi không có gói (Mix_QuickLoad_RAW không sở hữu dữ liệu)
+    SoundBoard sounds;
+    Mix_Music* gameOverMusic = nullptr; // Đoạn dài: đọc dần từ file khi phát thay vì giải mã sẵn cả đoạn
+
+    Game(bool headlessMode = false, bool vsync = true, int aiThreads = 0) : player1(), player2(), headless(headlessMode) {
+        setAIThreads(aiThreads);
+        enemies.reserve(ENEMY_STORE_CAPACITY); enemyRects.reserve(ENEMY_STORE_CAPACITY); enemyGrid.reserve(ENEMY_STORE_CAPACITY);
+        walls.reserve(MAP_WIDTH * MAP_HEIGHT); levelScratch.walls.reserve(MAP_WIDTH * MAP_HEIGHT); // Hai bộ đệm setupLevel() hoán đổi qua lại
+        if (headless) { autoPlayers = true; instantTransitions = true; return; } // Mô phỏng thuần: không cần SDL video/audio, không nạp media
+        LOG_INFO("Initializing Game...");
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) { LOG_ERROR("SDL Init Error: %s", SDL_GetError()); running = false; return; }
+        LOG_INFO("SDL Initialized.");
+        int imgFlags = IMG_INIT_PNG | IMG_INIT_JPG;
+        if (!(IMG_Init(imgFlags) & imgFlags)) { LOG_ERROR("SDL_image Error: %s", IMG_GetError()); running = false; SDL_Quit(); return; }
+        LOG_INFO("SDL_image Initialized.");
+        if (Mix_OpenAudio(AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, AUDIO_CHANNELS, 2048) < 0) { LOG_WARN("SDL_mixer Error: %s", Mix_GetError()); } else { audioOpen = true; LOG_INFO("SDL_mixer Initialized."); }
+
+        window = SDL_CreateWindow("Battle City Clone - Select Mode", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+        if (!window) { LOG_ERROR("Window Creation Error: %s", SDL_GetError()); running = false; Mix_Quit(); IMG_Quit(); SDL_Quit(); return; }
+        LOG_INFO("Window Created.");
+
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+        if (!renderer) { LOG_ERROR("Renderer Creation Error: %s", SDL_GetError()); running = false; SDL_DestroyWindow(window); Mix_Quit(); IMG_Quit(); SDL_Quit(); return; }
+        LOG_INFO("Renderer Created.");
+
+        currentState = GameState::SELECT_MODE;
+        if (!loadMedia()) { LOG_ERROR("Failed to load essential media! Exiting."); running = false; SDL_DestroyRenderer(renderer); SDL_DestroyWindow(window); Mix_Quit(); IMG_Quit(); SDL_Quit(); return; }
+        rng.seed((Uint64)time(0));
+        profiler.active = (BATTLECITY_PROFILER != 0);
+        LOG_INFO("Game Initialized Successfully. Showing Menu.");
+    }
+
+    ~Game() {
+        if (headless) return;
+        LOG_INFO("Cleaning Game Resources...");
+        if(menuTexture) SDL_DestroyTexture(menuTexture);
+        sprites.destroy();
+        if(gameOverTexture) SDL_DestroyTexture(gameOverTexture);
+        if(terrainLayer) SDL_DestroyTexture(terrainLayer);
+        if(bushLayer) SDL_DestroyTexture(bushLayer);
+        if (sounds.posted) LOG_INFO("Sound events: %llu posted, %llu played, %llu coalesced, %llu rate-limited, %llu dropped, %llu voices stolen.",
+                                    (unsigned long long)sounds.posted, (unsigned long long)sounds.played, (unsigned long long)sounds.coalesced,
+                                    (unsigned long long)sounds.rateLimited, (unsigned long long)sounds.dropped, (unsigned long long)sounds.stolen);
+        if (audioOpen) Mix_HaltChannel(-1);
+        sounds.freeChunks();
+        if (gameOverMusic) { Mix_HaltMusic(); Mix_FreeMusic(gameOverMusic); }
+        if (renderer) SDL_DestroyRenderer(renderer);
+        if (window) SDL_DestroyWindow(window);
+        Mix_CloseAudio(); Mix_Quit(); IMG_Quit(); SDL_Quit();
+        LOG_INFO("Game Resources Cleaned.");
+    }
+
+    // PCM của mỗi hiệu ứng ngắn: lấy thẳng từ gói nếu khớp định dạng mixer, nếu không giải mã WAV trên
+    // luồng phụ. game_over.wav phát qua Mix_Music (đọc dần từ file), không giữ bản PCM trong bộ nhớ.
+    void loadSounds() {
+        static const char* const SOUND_FILES[] = {"bullet_shot.wav", "broken.wav", "level_up.wav"};
+        const int SOUND_COUNT = sizeof(SOUND_FILES) / sizeof(SOUND_FILES[0]);
+        int freq = 0, channels = 0; Uint16 format = 0;
+        if (!audioOpen || !Mix_QuerySpec(&freq, &format, &channels)) return;
+
+        Mix_Chunk* chunks[SOUND_COUNT] = {};
+        vector<int> toDecode;
+        for (int i = 0; i < SOUND_COUNT; ++i) {
+            const BundleEntry* e = assets.find(SOUND_FILES[i], BundleKind::PCM);
+            if (e && e->a == (Uint32)freq && e->b == format && e->c == (Uint32)channels) chunks[i] = Mix_QuickLoad_RAW((Uint8*)assets.data(*e), (Uint32)e->size);
+            else toDecode.push_back(i);
+        }
+        soundBuffers.assign(SOUND_COUNT, vector<Uint8>());
+        vector<char> decoded(SOUND_COUNT, 0);
+        parallelFor((int)toDecode.size(), [&](int k) { int i = toDecode[k]; decoded[i] = decodeWavFile(SOUND_FILES[i], freq, format, channels, soundBuffers[i]); });
+        for (int i : toDecode) if (decoded[i]) chunks[i] = Mix_QuickLoad_RAW(soundBuffers[i].data(), (Uint32)soundBuffers[i].size());
+
+        for (int i = 0; i < SOUND_COUNT; ++i) {
+            if (!chunks[i]) LOG_WARN("Failed to load sound: %s - %s", SOUND_FILES[i], SDL_GetError());
+            else LOG_INFO("Loaded sound: %s", SOUND_FILES[i]);
+        }
+        sounds.chunks[(int)SoundId::BULLET_SHOT] = chunks[0]; sounds.chunks[(int)SoundId::TANK_BROKEN] = chunks[1];
+        sounds.chunks[(int)SoundId::LEVEL_UP] = chunks[2]; sounds.chunks[(int)SoundId::PLAYER_DESTROYED] = chunks[1];
+        sounds.open();
+        gameOverMusic = Mix_LoadMUS("game_over.wav");
+        if (!gameOverMusic) LOG_WARN("Failed to open music: game_over.wav - %s", Mix_GetError());
+    }
+
+    // Atlas xếp sẵn trong gói (pixel + bảng vùng); nếu thiếu thì xếp lại từ các file PNG
+    bool loadSpriteAtlas() {
+        const BundleEntry* layout = assets.find("@atlas_regions", BundleKind::BLOB);
+        SDL_Surface* packed = (layout && layout->size == sizeof(sprites.regions)) ? assets.surface("@atlas") : nullptr;
+        if (!packed) return sprites.load(renderer);
+        memcpy(sprites.regions, assets.data(*layout), sizeof(sprites.regions));
+        sprites.width = packed->w; sprites.height = packed->h;
+        bool uploaded = sprites.upload(renderer, packed);
+        SDL_FreeSurface(packed);
+        return uploaded;
+    }
+
+    bool loadMedia() {
+         LOG_INFO("Loading media..."); bool essential_success = true;
+         Uint64 loadStart = SDL_GetPerformanceCounter();
+         if (assets.open(ASSET_BUNDLE_PATH)) LOG_INFO("Using asset bundle %s", ASSET_BUNDLE_PATH);
+         static const char* const SCREEN_IMAGES[] = {"giao_dien.jpg", "game_over.png"};
+         SDL_Surface* screens[2] = {assets.surface(SCREEN_IMAGES[0]), assets.surface(SCREEN_IMAGES[1])};
+         parallelFor(2, [&](int i) { if (!screens[i]) screens[i] = decodeImageFile(SCREEN_IMAGES[i]); });
+         SDL_Texture* screenTextures[2] = {};
+         for (int i = 0; i < 2; ++i) {
+             if (!screens[i]) { LOG_ERROR("Unable to load image %s! SDL_image Error: %s", SCREEN_IMAGES[i], IMG_GetError()); continue; }
+             screenTextures[i] = SDL_CreateTextureFromSurface(renderer, screens[i]); SDL_FreeSurface(screens[i]);
+         }
+         menuTexture = screenTextures[0]; gameOverTexture = screenTextures[1];
+         if (!menuTexture) return false; else LOG_INFO("Loaded texture: giao_dien.jpg");
+         if (!gameOverTexture) LOG_WARN("Failed to load game_over.png!");
+         if (!loadSpriteAtlas()) essential_success = false;
+         loadSounds();
+         if (!essential_success) LOG_ERROR("Failed to load one or more essential game textures!");
+         double loadMs = (double)(SDL_GetPerformanceCounter() - loadStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+         LOG_INFO("Media loading finished in %.1f ms.", loadMs); return essential_success;
+    }
+
+    // Số luồng phụ cho pha AI của địch (0 = tuần tự trên luồng chính)
+    void setAIThreads(int workerThreads) { aiWorkers.reset(workerThreads > 0 ? new WorkerPool(workerThreads) : nullptr); }
+
+    void startMatch(int players, int level) {
+        numberOfPlayers = players; currentState = GameState::PLAYING;
+        matchOver = false; matchWon = false; tick = 0; lastSpawnTick = 0; enemiesDestroyed = 0; playerHits = 0;
+        bot1 = PlayerBotState(); bot2 = PlayerBotState();
+        memset(heldInput, 0, sizeof(heldInput)); memset(tappedInput, 0, sizeof(tappedInput)); memset(appliedInput, 0, sizeof(appliedInput));
+        if (recordPath) { inputLog.begin(players, level, fixedMapSeed, rng.state); recording = true; }
+        setupLevel(level);
+    }
+
+    // Ghi file replay của trận đang ghi (khi thoát game)
+    void finishRecording() {
+        if (!recording) return;
+        recording = false;
+        inputLog.header.finalHash = stateHash();
+        if (inputLog.save(recordPath)) LOG_INFO("Replay written to %s (%u ticks, %u bytes of input).", recordPath, inputLog.header.tickCount, (unsigned)(inputLog.runs.size() * sizeof(InputRun)));
+        else LOG_ERROR("Failed to write replay %s", recordPath);
+    }
+
+    // FNV-1a trên trạng thái mô phỏng (không gồm thứ chỉ để vẽ), để so phát lại với bản ghi
+    Uint64 stateHash() const {
+        Uint64 h = 1469598103934665603ULL;
+        auto mix = [&h](Uint64 v) { for (int i = 0; i < 8; ++i) { h ^= (v >> (i * 8)) & 0xFF; h *= 1099511628211ULL; } };
+        mix(tick); mix(currentLevel); mix(rng.state); mix(enemiesToSpawn); mix((Uint64)currentState);
+        for (const PlayerTank* p : {&player1, &player2}) { mix((Uint32)p->fx); mix((Uint32)p->fy); mix(p->isActive); mix((Uint32)p->lastDirX); mix((Uint32)p->lastDirY); }
+        for (int i = 0; i < enemies.size(); ++i) { const EnemyHot& e = enemies.hot[i]; mix(enemies.cold[i].id); mix((Uint32)e.fx); mix((Uint32)e.fy); mix((Uint32)e.hitPoints); mix(e.active); mix(enemies.cold[i].rngState); }
+        for (int i = 0; i < bullets.count; ++i) { mix((Uint32)bullets.fx[i]); mix((Uint32)bullets.fy[i]); mix((Uint32)bullets.owner[i]); mix((Uint32)bullets.alive[i]); }
+        for (int t = 0; t < 4; ++t) for (int r = 0; r < MAP_HEIGHT; ++r) mix(terrain.rows[t][r]);
+        return h;
+    }
+
+    Uint32 nextMapSeed() { return fixedMapSeed ? fixedMapSeed : rng.next(); }
+
+    void updateWindowTitle() {
+        if (window) { string title = "Battle City Clone - Level " + to_string(currentLevel) + " (" + to_string(numberOfPlayers) + "P)"; SDL_SetWindowTitle(window, title.c_str()); }
+    }
+
+    // Chụp trạng thái mô phỏng; false nếu vượt sức chứa cố định của WorldSnapshot
+    bool captureSnapshot(WorldSnapshot& s) const {
+        if ((int)walls.size() > SNAPSHOT_MAX_WALLS || enemies.slotCount() > SNAPSHOT_MAX_ENEMIES || bullets.count > SNAPSHOT_MAX_BULLETS) return false;
+        memset((void*)&s, 0, sizeof(s)); // Cả phần không dùng về 0 để delta nhỏ
+        s.rngState = rng.state; s.tick = tick; s.lastSpawnTick = lastSpawnTick;
+        s.state = (Sint32)currentState; s.level = currentLevel; s.numberOfPlayers = numberOfPlayers;
+        s.mapSeed = currentMapSeed; s.pendingMapSeed = pendingMapSeed;
+        s.transitionTicks = transitionTicks; s.transitionNextLevel = transitionNextLevel;
+        s.enemiesToSpawn = enemiesToSpawn; s.enemiesOnScreen = enemiesOnScreen; s.maxEnemiesOnScreen = maxEnemiesOnScreen;
+        s.toughToSpawn = toughEnemiesToSpawnThisLevel; s.toughSpawned = toughEnemiesSpawnedThisLevel; s.nextEnemyId = nextEnemyId;
+        s.bots[0] = bot1; s.bots[1] = bot2;
+        s.matchOver = matchOver; s.matchWon = matchWon; s.appliedInput[0] = appliedInput[0]; s.appliedInput[1] = appliedInput[1];
+        s.wallCount = (Uint16)walls.size(); s.enemyCount = (Uint16)enemies.size(); s.bulletCount = (Uint16)bullets.count;
+        const PlayerTank* players[2] = {&player1, &player2};
+        for (int i = 0; i < 2; ++i) {
+            const PlayerTank& p = *players[i]; PlayerSnapshot& ps = s.players[i];
+            ps.fx = p.fx; ps.fy = p.fy; ps.prevFx = p.prevFx; ps.prevFy = p.prevFy; ps.velocityX = p.velocityX; ps.velocityY = p.velocityY;
+            ps.shotDelayCounter = p.shotDelayCounter; ps.lastDirX = (Sint8)p.lastDirX; ps.lastDirY = (Sint8)p.lastDirY; ps.isActive = p.isActive;
+        }
+        for (size_t i = 0; i < walls.size(); ++i) if (!walls[i].active) s.destroyedWalls[i / 8] |= (Uint8)(1 << (i % 8));
+        for (int i = 0; i < enemies.size(); ++i) {
+            Uint32 slot = enemies.handle(i).slot; s.enemySlots[i] = (Uint8)slot;
+            const EnemyHot& e = enemies.hot[i]; const EnemyCold& c = enemies.cold[i]; EnemySnapshot& es = s.enemies[slot];
+            es.id = c.id; es.fx = e.fx; es.fy = e.fy; es.prevFx = e.prevFx; es.prevFy = e.prevFy; es.velocityX = e.velocityX; es.velocityY = e.velocityY;
+            es.moveDecisionDelay = c.moveDecisionDelay; es.flowDetourTicks = c.flowDetourTicks; es.shootDelay = c.shootDelay;
+            es.hitStartTick = c.hitStartTick; es.rngState = c.rngState; es.lastDirX = (Sint8)e.lastDirX; es.lastDirY = (Sint8)e.lastDirY;
+            es.level = (Uint8)c.level; es.hitPoints = (Uint8)e.hitPoints; es.initialHitPoints = (Uint8)c.initialHitPoints;
+            es.active = e.active; es.isHit = c.isHit; es.wantsToShoot = c.wantsToShoot;
+        }
+        for (int i = 0; i < bullets.count; ++i)
+            s.bullets[i] = {bullets.fx[i], bullets.fy[i], bullets.prevFx[i], bullets.prevFy[i], bullets.dx[i], bullets.dy[i], bullets.owner[i]};
+        return true;
+    }
+
+    // Khôi phục ảnh chụp: chỉ sinh lại tường khi khác (màn, map seed), còn lại là chép trường.
+    // resumeSimulation = false (client mạng chỉ vẽ): không dựng lại màn đang chờ trên luồng nền.
+    void restoreSnapshot(const WorldSnapshot& s, bool resumeSimulation = true) {
+        bool titleChanged = s.level != currentLevel || s.numberOfPlayers != numberOfPlayers;
+        if (s.level != currentLevel || s.mapSeed != currentMapSeed || walls.size() != s.wallCount) {
+            walls = LevelMapCache::instance().get(s.level, s.mapSeed)->walls;
+            currentLevel = s.level; currentMapSeed = s.mapSeed;
+            terrainCacheValid = false;
+        }
+        bool wallsChanged = false;
+        for (size_t i = 0; i < walls.size(); ++i) {
+            bool active = !(s.destroyedWalls[i / 8] & (1 << (i % 8)));
+            if (walls[i].active != active) { walls[i].active = active; markTerrainDirty(walls[i]); wallsChanged = true; }
+        }
+        if (wallsChanged || !terrainCacheValid) {
+            terrain.build(walls); sight.build(terrain);
+            for (auto& f : playerFlow) f.invalidate();
+        }
+
+        rng.state = s.rngState; tick = s.tick; lastSpawnTick = s.lastSpawnTick;
+        currentState = (GameState)s.state; numberOfPlayers = s.numberOfPlayers;
+        transitionTicks = s.transitionTicks; transitionNextLevel = s.transitionNextLevel;
+        enemiesToSpawn = s.enemiesToSpawn; enemiesOnScreen = s.enemiesOnScreen; maxEnemiesOnScreen = s.maxEnemiesOnScreen;
+        toughEnemiesToSpawnThisLevel = s.toughToSpawn; toughEnemiesSpawnedThisLevel = s.toughSpawned; nextEnemyId = s.nextEnemyId;
+        bot1 = s.bots[0]; bot2 = s.bots[1];
+        matchOver = s.matchOver; matchWon = s.matchWon; appliedInput[0] = s.appliedInput[0]; appliedInput[1] = s.appliedInput[1];
+        PlayerTank* players[2] = {&player1, &player2};
+        for (int i = 0; i < 2; ++i) {
+            PlayerTank& p = *players[i]; const PlayerSnapshot& ps = s.players[i];
+            p.fx = ps.fx; p.fy = ps.fy; p.prevFx = ps.prevFx; p.prevFy = ps.prevFy; p.velocityX = ps.velocityX; p.velocityY = ps.velocityY;
+            p.x = fromFixed(p.fx); p.y = fromFixed(p.fy); p.rect = {p.x, p.y, TILE_SIZE, TILE_SIZE};
+            p.shotDelayCounter = ps.shotDelayCounter; p.lastDirX = ps.lastDirX; p.lastDirY = ps.lastDirY; p.isActive = ps.isActive;
+        }
+        enemies.clear();
+        for (int i = 0; i < min<int>(s.enemyCount, SNAPSHOT_MAX_ENEMIES); ++i) { // Theo thứ tự dày đặc cũ, mỗi xe về đúng slot cũ
+            if (s.enemySlots[i] >= SNAPSHOT_MAX_ENEMIES) continue;
+            const EnemySnapshot& es = s.enemies[s.enemySlots[i]];
+            int k = enemies.find(enemies.spawnInSlot(s.enemySlots[i], fromFixed(es.fx), fromFixed(es.fy), es.level, 0, es.initialHitPoints));
+            if (k < 0) continue;
+            EnemyHot& e = enemies.hot[k]; EnemyCold& c = enemies.cold[k];
+            c.id = es.id; e.fx = es.fx; e.fy = es.fy; e.prevFx = es.prevFx; e.prevFy = es.prevFy; e.velocityX = es.velocityX; e.velocityY = es.velocityY;
+            c.moveDecisionDelay = es.moveDecisionDelay; c.flowDetourTicks = es.flowDetourTicks; c.shootDelay = es.shootDelay;
+            c.hitStartTick = es.hitStartTick; c.rngState = es.rngState; e.lastDirX = es.lastDirX; e.lastDirY = es.lastDirY;
+            e.hitPoints = es.hitPoints; e.active = es.active; c.isHit = es.isHit; c.wantsToShoot = es.wantsToShoot;
+        }
+        bullets.clear();
+        for (int i = 0; i < s.bulletCount; ++i) { const BulletSnapshot& b = s.bullets[i]; bullets.restore(b.fx, b.fy, b.prevFx, b.prevFy, b.dx, b.dy, b.owner); }
+        if (resumeSimulation && currentState == GameState::LEVEL_TRANSITION && transitionNextLevel != 0) { // Dựng lại màn đang chờ
+            pendingMapSeed = s.pendingMapSeed;
+            pendingLevel = std::async(std::launch::async, buildLevelPlan, transitionNextLevel, pendingMapSeed);
+        }
+        if (titleChanged) updateWindowTitle();
+    }
+
+    // Dựng màn ngay trên luồng gọi (bắt đầu trận, chế độ headless) vào levelScratch. applyLevelPlan() chỉ
+    // hoán đổi walls nên levelScratch giữ lại bộ đệm của màn cũ: đặt lại ván và qua màn không cấp phát.
+    void setupLevel(int level) {
+        if (!headless) LOG_INFO("Loading Level %d...", level);
+        rebuildLevelPlan(levelScratch, level, nextMapSeed());
+        applyLevelPlan(std::move(levelScratch));
+    }
+
+    // Hoán đổi màn đã chuẩn bị vào: chỉ còn việc di chuyển vector, đặt lại người chơi và sinh địch đầu màn
+    void applyLevelPlan(LevelPlan&& plan) {
+        currentLevel = plan.level; currentMapSeed = plan.seed;
+        updateWindowTitle();
+        walls.swap(plan.walls); terrain = plan.terrain; sight = plan.sight;
+        playerFlow[0] = plan.playerFlow[0]; playerFlow[1] = plan.playerFlow[1];
+        enemies.clear(); bullets.clear(); nextEnemyId = 0;
+        terrainCacheValid = false;
+        player1.reset(PLAYER1_START_X, PLAYER_START_Y);
+        if (numberOfPlayers == 2) player2.reset(PLAYER2_START_X, PLAYER_START_Y); else player2.isActive = false;
+        enemiesToSpawn = plan.enemiesToSpawn; maxEnemiesOnScreen = plan.maxEnemiesOnScreen; toughEnemiesToSpawnThisLevel = plan.toughEnemies;
+        toughEnemiesSpawnedThisLevel = 0; enemiesOnScreen = 0;
+        spawnInitialEnemies();
+        if (!headless) LOG_INFO("Level %d Started.", currentLevel);
+    }
+
+    // Qua màn (chế độ cửa sổ): vẫn vẽ và nhận phím trong lúc màn kế tiếp được dựng trên luồng nền
+    void beginLevelTransition() {
+        LOG_INFO("LEVEL %d CLEARED!", currentLevel);
+        sounds.post(SoundId::LEVEL_UP, true);
+        currentState = GameState::LEVEL_TRANSITION;
+        if (currentLevel < maxLevels) {
+            LOG_INFO("Proceeding to next level...");
+            transitionNextLevel = currentLevel + 1; transitionTicks = LEVEL_CLEAR_TICKS;
+            pendingMapSeed = nextMapSeed();
+            pendingLevel = std::async(std::launch::async, buildLevelPlan, transitionNextLevel, pendingMapSeed);
+        } else {
+            LOG_INFO("CONGRATULATIONS! YOU WIN!");
+            matchWon = true; matchOver = true;
+            transitionNextLevel = 0; transitionTicks = VICTORY_TICKS;
+        }
+    }
+
+    void updateLevelTransition() {
+        if (transitionTicks > 0) { transitionTicks--; return; }
+        if (transitionNextLevel == 0) { running = false; return; } // Hết màn chúc mừng: thoát như trước
+        // Hoán đổi đúng ở tick này để trận tất định (phát lại chạy hết tốc độ có thể tới đây trước khi luồng
+        // nền xong thì chờ); chơi thật thì màn đã dựng xong từ lâu trong 2.5 s chuyển tiếp nên get() không chờ
+        applyLevelPlan(pendingLevel.get());
+        currentState = GameState::PLAYING;
+    }
+
+    void spawnInitialEnemies() {
+        int count = 0;
+        while (count < maxEnemiesOnScreen && enemiesToSpawn > 0) {
+            if (!trySpawnOneEnemy()) {
+                if (!headless) LOG_WARN("Could not spawn initial enemy.");
+                break;
+            } count++;
+        }
+    }
+
+    bool trySpawnOneEnemy() {
+        if (enemiesOnScreen >= maxEnemiesOnScreen || enemiesToSpawn <= 0) return false;
+        pair<int, int> spawnPoints[3]; // Cố định theo ENEMY_SPAWN_TILES, nằm trên stack
+        for (int i = 0; i < 3; ++i) spawnPoints[i] = {ENEMY_SPAWN_TILES[i][0] * TILE_SIZE, ENEMY_SPAWN_TILES[i][1] * TILE_SIZE};
+        for (int i = 2; i > 0; --i) std::swap(spawnPoints[i], spawnPoints[rng.below(i + 1)]);
+        for (const auto& sp : spawnPoints) {
+            SDL_Rect spawnRect = {sp.first, sp.second, TILE_SIZE, TILE_SIZE};
+            bool canSpawn = true;
+            if (terrain.blocksTank(spawnRect)) canSpawn = false;
+            if (canSpawn && player1.isActive && SDL_HasIntersection(&spawnRect, &player1.rect)) canSpawn = false;
+            if (canSpawn && numberOfPlayers == 2 && player2.isActive && SDL_HasIntersection(&spawnRect, &player2.rect)) canSpawn = false;
+            if (canSpawn) for (const auto& e : enemies.hot) if (e.active && SDL_HasIntersection(&spawnRect, &e.rect)) { canSpawn = false; break; }
+            if (canSpawn) {
+                int initialHP = 1;
+                if (toughEnemiesSpawnedThisLevel < toughEnemiesToSpawnThisLevel) { initialHP = TOUGH_ENEMY_HP; toughEnemiesSpawnedThisLevel++; }
+                EnemyHandle h = enemies.spawn(sp.first, sp.second, currentLevel, rng.next(), initialHP);
+                enemies.cold[enemies.find(h)].id = nextEnemyId++;
+                enemiesOnScreen++; enemiesToSpawn--; return true;
+            }
+        }
+        if (!headless) LOG_RATE_LIMITED(LogLevel::WARN, 5000, "Failed to find a free spawn point for enemy.");
+        return false;
+    }
+
+    void handleEvents() {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) { running = false; return; }
+            if (event.type == SDL_RENDER_TARGETS_RESET || event.type == SDL_RENDER_DEVICE_RESET) terrainCacheValid = false; // Nội dung render target bị mất
+#if BATTLECITY_PROFILER
+            if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F3) { profilerOverlay = !profilerOverlay; continue; }
+            if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F4) {
+                if (profiler.exportTrace(PROFILER_TRACE_PATH)) LOG_INFO("Profiler trace written to %s", PROFILER_TRACE_PATH);
+                else LOG_ERROR("Failed to write %s", PROFILER_TRACE_PATH);
+                continue;
+            }
+#endif
+            if (event.type == SDL_KEYDOWN && event.key.repeat == 0 && (currentState == GameState::PLAYING || currentState == GameState::LEVEL_TRANSITION)) {
+                if (event.key.keysym.sym == SDLK_F5 && !netClient) {
+                    if (!quickSave) quickSave.reset(new WorldSnapshot);
+                    if (captureSnapshot(*quickSave)) LOG_INFO("Quick save at tick %u.", tick); else { quickSave.reset(); LOG_WARN("Quick save failed: world too large for a snapshot."); }
+                    continue;
+                }
+                if (event.key.keysym.sym == SDLK_F9 && !netClient) {
+                    if (recording) LOG_WARN("Quick load is disabled while recording a replay.");
+                    else if (quickSave) { restoreSnapshot(*quickSave); LOG_INFO("Quick load: back to tick %u.", tick); }
+                    continue;
+                }
+            }
+            if (netClient) { handleGameplayInput(event); continue; } // Client: trạng thái do máy chủ quyết định
+            switch (currentState) {
+                case GameState::SELECT_MODE: handleMenuInput(event); break;
+                case GameState::PLAYING:     handleGameplayInput(event); break;
+                case GameState::LEVEL_TRANSITION: handleGameplayInput(event); break; // Vẫn theo dõi phím giữ/nhả, ESC để thoát
+                case GameState::GAME_OVER:   if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) running = false; break; // Cho phép thoát ở Game Over
+            }
+        }
+    }
+
+    void handleMenuInput(const SDL_Event& event) {
+        if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
+            switch (event.key.keysym.sym) {
+                case SDLK_1: LOG_INFO("Selected 1 Player mode."); startMatch(1, 1); break;
+                case SDLK_2: LOG_INFO("Selected 2 Players mode."); startMatch(2, 1); break;
+                case SDLK_ESCAPE: running = false; break;
+            }
+        }
+    }
+
+    // Phím chỉ cập nhật mặt nạ giữ/nhấn; update() lấy mẫu mỗi tick rồi áp dụng qua applyPlayerInput
+    void handleGameplayInput(const SDL_Event& event) {
+        if ((event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) || event.key.repeat != 0) return;
+        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) { running = false; return; }
+        int player = -1; Uint8 bit = 0;
+        switch (event.key.keysym.sym) {
+            case SDLK_w: player = 0; bit = INPUT_UP; break;
+            case SDLK_s: player = 0; bit = INPUT_DOWN; break;
+            case SDLK_a: player = 0; bit = INPUT_LEFT; break;
+            case SDLK_d: player = 0; bit = INPUT_RIGHT; break;
+            case SDLK_j: player = 0; bit = INPUT_FIRE; break;
+            case SDLK_UP:    player = 1; bit = INPUT_UP; break;
+            case SDLK_DOWN:  player = 1; bit = INPUT_DOWN; break;
+            case SDLK_LEFT:  player = 1; bit = INPUT_LEFT; break;
+            case SDLK_RIGHT: player = 1; bit = INPUT_RIGHT; break;
+            case SDLK_RCTRL: case SDLK_LCTRL: player = 1; bit = INPUT_FIRE; break;
+            default: return;
+        }
+        if (event.type == SDL_KEYDOWN) { tappedInput[player] |= bit; if (bit != INPUT_FIRE) heldInput[player] |= bit; }
+        else heldInput[player] &= ~bit;
+    } // End handleGameplayInput
+
+    // Mặt nạ của tick này: từ bản ghi khi phát lại, nếu không thì từ bàn phím
+    Uint16 sampleTickInput() {
+        if (replayInput) return replayInput->next();
+        if (useNetworkInput) return networkInput;
+        Uint16 input = (Uint16)((heldInput[0] | tappedInput[0]) | ((heldInput[1] | tappedInput[1]) << 8));
+        tappedInput[0] = tappedInput[1] = 0;
+        return input;
+    }
+
+    // Cạnh nhấn/nhả của phím hướng làm giống hệt xử lý sự kiện phím cũ: nhấn đặt vận tốc trục đó và
+    // hướng nhìn, nhả chỉ dừng trục đó nếu đang đi theo chiều ấy; bắn ở tick có lần nhấn mới
+    void applyPlayerInput(PlayerTank& p, int ownerId, Uint8 input, Uint8& previous) {
+        Uint8 directions = input & INPUT_DIRECTIONS;
+        Uint8 pressed = directions & ~previous, released = previous & ~directions;
+        previous = directions;
+        if (!p.isActive) return;
+        if (released) {
+            if ((released & INPUT_UP) && p.velocityY < 0) p.velocityY = 0;
+            if ((released & INPUT_DOWN) && p.velocityY > 0) p.velocityY = 0;
+            if ((released & INPUT_LEFT) && p.velocityX < 0) p.velocityX = 0;
+            if ((released & INPUT_RIGHT) && p.velocityX > 0) p.velocityX = 0;
+            if (p.velocityX == 0 && p.velocityY != 0) { p.lastDirX = 0; p.lastDirY = (p.velocityY > 0) ? 1 : -1; }
+            else if (p.velocityY == 0 && p.velocityX != 0) { p.lastDirY = 0; p.lastDirX = (p.velocityX > 0) ? 1 : -1; }
+        }
+        if (pressed & INPUT_UP)    { p.velocityY = -PLAYER_SPEED_FP; p.lastDirY = -1; p.lastDirX = 0; }
+        if (pressed & INPUT_DOWN)  { p.velocityY = PLAYER_SPEED_FP; p.lastDirY = 1; p.lastDirX = 0; }
+        if (pressed & INPUT_LEFT)  { p.velocityX = -PLAYER_SPEED_FP; p.lastDirX = -1; p.lastDirY = 0; }
+        if (pressed & INPUT_RIGHT) { p.velocityX = PLAYER_SPEED_FP; p.lastDirX = 1; p.lastDirY = 0; }
+        if ((input & INPUT_FIRE) && p.shoot(bullets, ownerId)) sounds.post(SoundId::BULLET_SHOT, true);
+    }
+
+    void update() {
+         if (!running) return;
+         if (netClient) { updateNetClient(); return; }
+         if (currentState != GameState::PLAYING && currentState != GameState::LEVEL_TRANSITION) return;
+         // Mọi tick của trận (kể cả lúc chuyển màn) tiêu thụ đúng một mặt nạ, nên bản ghi khớp từng tick
+         Uint16 input = autoPlayers ? 0 : sampleTickInput();
+         if (recording) inputLog.push(input);
+         if (currentState == GameState::LEVEL_TRANSITION) { updateLevelTransition(); return; }
+         PROFILE_SCOPE(profiler, ProfilePhase::UPDATE);
+         tick++;
+
+         rebuildEnemyGrid();
+
+         // Bot điều khiển người chơi (trận AI-vs-AI), hoặc đầu vào bàn phím/bản ghi của tick này
+         if (autoPlayers) { updatePlayerBot(player1, bot1, OWNER_PLAYER1); if (numberOfPlayers == 2) updatePlayerBot(player2, bot2, OWNER_PLAYER2); }
+         else {
+             applyPlayerInput(player1, OWNER_PLAYER1, (Uint8)(input & 0xFF), appliedInput[0]);
+             if (numberOfPlayers == 2) applyPlayerInput(player2, OWNER_PLAYER2, (Uint8)(input >> 8), appliedInput[1]);
+         }
+
+         // Cập nhật Người Chơi
+         if (player1.isActive) { player1.updateCooldown(); player1.updatePosition(terrain, enemies, enemyGrid); }
+         if (numberOfPlayers == 2 && player2.isActive) { player2.updateCooldown(); player2.updatePosition(terrain, enemies, enemyGrid); }
+
+         // Trường hướng tới từng người chơi: chỉ tính lại khi người chơi sang ô khác
+         if (player1.isActive) playerFlow[0].retarget(terrain, (player1.x + TILE_SIZE / 2) / TILE_SIZE, (player1.y + TILE_SIZE / 2) / TILE_SIZE);
+         if (numberOfPlayers == 2 && player2.isActive) playerFlow[1].retarget(terrain, (player2.x + TILE_SIZE / 2) / TILE_SIZE, (player2.y + TILE_SIZE / 2) / TILE_SIZE);
+
+         // Cập nhật Kẻ Địch, pha 1 (AI): mỗi xe chỉ đọc ảnh chụp đầu tick và ghi trạng thái của chính nó,
+         // nên chạy song song được mà kết quả giống hệt chạy tuần tự
+         {
+         PROFILE_SCOPE(profiler, ProfilePhase::AI);
+         auto thinkEnemy = [&](int i) {
+             if (!enemies.hot[i].active) return;
+             enemies.updateHitStatus(i, tick);
+             enemies.updateAIAndVelocity(i, player1, player2, numberOfPlayers, terrain, sight, enemyRects, enemyGrid, playerFlow);
+         };
+         if (aiWorkers && enemies.size() >= PARALLEL_AI_MIN_ENEMIES) aiWorkers->run(enemies.size(), thinkEnemy);
+         else for (int i = 0; i < enemies.size(); ++i) thinkEnemy(i);
+         }
+
+         // Pha 2 (áp dụng): tuần tự theo chỉ số dày đặc, bắn rồi di chuyển, cập nhật ảnh chụp cho xe sau
+         for (int i = 0; i < enemies.size(); ++i) {
+             if (!enemies.hot[i].active) continue;
+             EnemyCold& c = enemies.cold[i];
+             if (c.wantsToShoot) { c.wantsToShoot = false; if (enemies.shoot(i, bullets)) sounds.post(SoundId::BULLET_SHOT, false); }
+             enemies.updatePosition(i, terrain, enemyRects, enemyGrid);
+             enemyRects[i] = enemies.hot[i].rect;
+         }
+
+         // Di Chuyển Toàn Bộ Đạn
+         bullets.integrate();
+
+         resolveBulletCollisions(); // Xử Lý Va Chạm Đạn
+         bullets.compact();
+
+         // Dọn Dẹp Địch và Tạo Mới
+         enemies.removeInactive();
+         enemiesOnScreen = enemies.size();
+         if (enemiesToSpawn > 0 && enemiesOnScreen < maxEnemiesOnScreen) {
+             if (tick > lastSpawnTick + ENEMY_SPAWN_DELAY_TICKS) {
+                 if (trySpawnOneEnemy()) lastSpawnTick = tick; else lastSpawnTick = tick - ENEMY_SPAWN_DELAY_TICKS / 2;
+             }
+         }
+
+         // Kiểm Tra Thua Game
+         bool player1_is_out = !player1.isActive;
+         bool player2_is_out = (numberOfPlayers == 1) || (numberOfPlayers == 2 && !player2.isActive);
+         if (player1_is_out && player2_is_out) {
+             if (!headless) LOG_INFO("All players out! Game Over at Level %d.", currentLevel);
+             if (gameOverMusic) Mix_PlayMusic(gameOverMusic, 0);
+             currentState = GameState::GAME_OVER; matchOver = true; return;
+         }
+
+         // Kiểm Tra Thắng Màn
+         if (currentLevel > 0 && enemiesToSpawn == 0 && enemies.empty()) {
+             if (instantTransitions) { // Mô phỏng thuần: chuyển màn ngay, không chờ
+                 if (currentLevel < maxLevels) setupLevel(currentLevel + 1); else { matchWon = true; matchOver = true; }
+                 return;
+             }
+             beginLevelTransition();
+         }
+    } // End update()
+
+    // Một tick của client mỏng: nhận ảnh chụp, gửi đầu vào, rồi dựng lại khung từ ảnh chụp mới nhất
+    // cộng dự đoán xe của mình với các đầu vào máy chủ chưa áp dụng (bỏ bit bắn: đạn chỉ máy chủ sinh)
+    void updateNetClient() {
+        NetClient& net = *netClient;
+        net.poll();
+        Uint32 now = netNowMs();
+        if (net.serverClosed) { if (headless) running = false; return; } // Cửa sổ giữ khung cuối tới khi bấm ESC
+        if (now - net.lastHeardMs > NET_TIMEOUT_MS) { LOG_WARN("Lost connection to server."); running = false; return; }
+        if (!net.welcomed) { if (now - net.lastHelloMs >= NET_HELLO_INTERVAL_MS) net.sendHello(); return; }
+        Uint8 mask;
+        if (headless) mask = net.scriptedInput();
+        else { Uint16 keys = sampleTickInput(); mask = (Uint8)((keys & 0xFF) | (keys >> 8)); } // Phím của cả hai bên đều điều khiển xe mình
+        net.sendInput(mask);
+        if (net.latestFrame == 0) return;
+
+        restoreSnapshot(net.latest(), false);
+        if (currentState != GameState::PLAYING) return;
+        PlayerTank& me = net.slot == 0 ? player1 : player2;
+        Uint8 previous = appliedInput[net.slot];
+        rebuildEnemyGrid();
+        Uint32 first = max(net.ackedInputSeq + 1, net.inputSeq >= NET_SNAPSHOT_HISTORY ? net.inputSeq - NET_SNAPSHOT_HISTORY + 1 : 1);
+        for (Uint32 seq = first; seq <= net.inputSeq && me.isActive; ++seq) {
+            applyPlayerInput(me, net.slot == 0 ? OWNER_PLAYER1 : OWNER_PLAYER2, net.sentMasks[seq % NET_SNAPSHOT_HISTORY] & ~INPUT_FIRE, previous);
+            me.updatePosition(terrain, enemies, enemyGrid);
+        }
+    }
+
+    // Dựng broadphase cho xe tăng địch (chỉ số trong enemies ổn định đến lúc dọn dẹp cuối tick)
+    void rebuildEnemyGrid() {
+        enemyGrid.clear();
+        enemyRects.resize(enemies.size());
+        for (int i = 0; i < enemies.size(); ++i) {
+            const EnemyHot& e = enemies.hot[i];
+            enemyRects[i] = e.active ? e.rect : SDL_Rect{0, 0, 0, 0};
+            if (!e.active) continue;
+            const SDL_Rect& r = e.rect;
+            enemyGrid.insert(i, {r.x - ENEMY_GRID_MARGIN, r.y - ENEMY_GRID_MARGIN, r.w + 2 * ENEMY_GRID_MARGIN, r.h + 2 * ENEMY_GRID_MARGIN});
+        }
+        enemyGrid.finish();
+    }
+
+    // Xử Lý Va Chạm Đạn (một lượt qua kho đạn chung); đạn chết chỉ được đánh dấu, compact() dọn sau.
+    // Va chạm liên tục: mỗi viên quét đoạn từ vị trí tick trước tới vị trí mới qua lưới ô (DDA) và qua xe
+    // tăng, vật bị chạm sớm nhất thắng (cùng lúc thì tường trước), nên tăng tốc độ đạn không làm đạn xuyên vật.
+    void resolveBulletCollisions() {
+        PROFILE_SCOPE(profiler, ProfilePhase::COLLISION);
+        for (int i = 0; i < bullets.count; ++i) {
+            if (!bullets.alive[i]) continue;
+            SDL_Rect from = bullets.prevRect(i), to = bullets.rect(i);
+            int dx = to.x - from.x, dy = to.y - from.y;
+            SDL_Rect swept = {min(from.x, to.x), min(from.y, to.y), from.w + std::abs(dx), from.h + std::abs(dy)};
+            int wallC, wallR; float tWall;
+            bool hitWall = terrain.sweepBullet(from, dx, dy, wallC, wallR, tWall);
+            float tFirst = hitWall ? tWall : 2.0f;
+            if (bullets.owner[i] < OWNER_ENEMY_BASE) { // Đạn người chơi -> địch
+                int target = -1;
+                enemyGrid.query(swept, [&](int id) {
+                    if (!enemies.hot[id].active) return;
+                    float t = sweptEntry(from, dx, dy, enemies.hot[id].rect);
+                    if (t >= 0 && (t < tFirst || (t == tFirst && target >= 0 && id < target))) { tFirst = t; target = id; }
+                });
+                if (target >= 0) {
+                    bullets.alive[i] = 0; enemies.takeHit(target, tick);
+                    if (!enemies.hot[target].active) { bullets.killOwner(OWNER_ENEMY_BASE + enemies.cold[target].id); sounds.post(SoundId::TANK_BROKEN, true); enemiesDestroyed++; } // Đạn biến mất cùng xe bị hạ
+                    continue;
+                }
+            } else { // Đạn địch -> người chơi
+                PlayerTank* hit = nullptr;
+                for (PlayerTank* p : {&player1, &player2}) {
+                    if (!p->isActive || (p == &player2 && numberOfPlayers != 2)) continue;
+                    float t = sweptEntry(from, dx, dy, p->rect);
+                    if (t >= 0 && t < tFirst) { tFirst = t; hit = p; }
+                }
+                if (hit) { bullets.alive[i] = 0; onPlayerHit(*hit); bullets.killOwner(hit == &player1 ? OWNER_PLAYER1 : OWNER_PLAYER2); continue; }
+            }
+            if (hitWall) { bullets.alive[i] = 0; if (terrain.has(WallType::BRICK, wallC, wallR)) destroyBrickAt(wallC, wallR); }
+            else if (BulletPool::outsidePlayfield(to)) bullets.alive[i] = 0;
+        }
+    }
+
+    // Ô có thể có gạch chồng: mỗi viên đạn tắt một viên gạch. Chỉ chạy khi đạn trúng gạch nên quét walls ở đây là đủ.
+    void destroyBrickAt(int c, int r) {
+        for (auto& w : walls)
+            if (w.active && w.type == WallType::BRICK && w.x / TILE_SIZE == c && w.y / TILE_SIZE == r) {
+                w.active = false; terrain.removeBrick(w); sight.openTile(terrain, c, r); markTerrainDirty(w); openFlowTile(w); return;
+            }
+    }
+
+    void markTerrainDirty(const Wall& w) { dirtyTerrainRows[w.y / TILE_SIZE] |= (Uint64)1 << (w.x / TILE_SIZE); }
+    void openFlowTile(const Wall& w) { for (auto& f : playerFlow) f.openTile(terrain, w.x / TILE_SIZE, w.y / TILE_SIZE); }
+
+    void onPlayerHit(PlayerTank& p) {
+        p.hitByEnemy(); playerHits++;
+        if (!headless) LOG_INFO("Player hit!");
+        sounds.post(SoundId::PLAYER_DESTROYED, true);
+    }
+
+    // --- BOT ĐƠN GIẢN CHO NGƯỜI CHƠI (trận AI-vs-AI) ---
+    // Bắn khi thẳng hàng với địch gần nhất, nếu không thì tiến lại gần theo trục xa hơn.
+    // Bị kẹt thì bắn phá phía trước rồi đi lang thang một lúc theo hướng ngẫu nhiên.
+    void updatePlayerBot(PlayerTank& p, PlayerBotState& bot, int ownerId) {
+        if (!p.isActive) return;
+        bool stuck = (p.x == bot.prevX && p.y == bot.prevY && (p.velocityX != 0 || p.velocityY != 0));
+        bot.prevX = p.x; bot.prevY = p.y;
+
+        const EnemyHot* target = nullptr; int bestDist = INT_MAX;
+        for (const auto& e : enemies.hot) {
+            if (!e.active) continue;
+            int d = std::abs(e.x - p.x) + std::abs(e.y - p.y);
+            if (d < bestDist) { bestDist = d; target = &e; }
+        }
+        if (!target) { p.velocityX = 0; p.velocityY = 0; return; }
+
+        int dx = target->x - p.x, dy = target->y - p.y;
+        if (std::abs(dy) < TILE_SIZE / 2 || std::abs(dx) < TILE_SIZE / 2) { // Thẳng hàng -> quay về phía địch và bắn
+            if (std::abs(dy) < TILE_SIZE / 2) { p.lastDirX = (dx > 0) ? 1 : -1; p.lastDirY = 0; }
+            else { p.lastDirY = (dy > 0) ? 1 : -1; p.lastDirX = 0; }
+            p.velocityX = 0; p.velocityY = 0;
+            if (p.shoot(bullets, ownerId)) sounds.post(SoundId::BULLET_SHOT, true);
+            return;
+        }
+
+        if (stuck) {
+            if (p.shoot(bullets, ownerId)) sounds.post(SoundId::BULLET_SHOT, true); // Phá gạch chắn đường
+            bot.wanderTicks = 20 + rng.below(40);
+            if (p.lastDirX != 0) { bot.wanderDirX = 0; bot.wanderDirY = rng.below(2) ? 1 : -1; }
+            else { bot.wanderDirY = 0; bot.wanderDirX = rng.below(2) ? 1 : -1; }
+        }
+        int dirX = 0, dirY = 0;
+        if (bot.wanderTicks > 0) { bot.wanderTicks--; dirX = bot.wanderDirX; dirY = bot.wanderDirY; }
+        else if (std::abs(dx) > std::abs(dy)) dirX = (dx > 0) ? 1 : -1;
+        else dirY = (dy > 0) ? 1 : -1;
+        p.velocityX = dirX * PLAYER_SPEED_FP; p.velocityY = dirY * PLAYER_SPEED_FP;
+        p.lastDirX = dirX; p.lastDirY = dirY;
+    }
+
+    // alpha: phần dư của bộ tích lũy thời gian / thời lượng tick, dùng để nội suy vị trí giữa hai tick
+    void render(float alpha = 1.0f) {
+        if (!renderer) return;
+        PROFILE_SCOPE(profiler, ProfilePhase::RENDER);
+        switch (currentState) {
+            case GameState::SELECT_MODE: {
+                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderClear(renderer);
+                if (menuTexture) SDL_RenderCopy(renderer, menuTexture, NULL, NULL);
+                else LOG_RATE_LIMITED(LogLevel::ERROR, 5000, "Menu texture is missing.");
+                break;
+            }
+            case GameState::PLAYING:
+            case GameState::LEVEL_TRANSITION: {
+                // Vẽ nền + tường (trừ bụi cỏ): một lần copy từ lớp dựng sẵn, nếu không có render target thì vẽ từng ô
+                refreshTerrainCache();
+                if (terrainLayer && terrainCacheValid) SDL_RenderCopy(renderer, terrainLayer, nullptr, nullptr);
+                else drawTerrainBase();
+                // Vẽ Địch, Người Chơi, Đạn: một lô, một lệnh vẽ
+                for (int i = 0; i < enemies.size(); ++i) {
+                    const EnemyHot& enemy = enemies.hot[i]; const EnemyCold& c = enemies.cold[i];
+                    if (!enemy.active) continue;
+                    SpriteId up = (c.initialHitPoints > 1) ? SpriteId::ENEMY3_UP : SpriteId::ENEMY2_UP; // Tank 3 / Tank 2
+                    SpriteId id = tankSprite(up, enemy.lastDirX, enemy.lastDirY, (SpriteId)((int)up + 1));
+                    SDL_Color tint = c.isHit ? SDL_Color{255, 100, 100, 200} : SDL_Color{255, 255, 255, 255};
+                    batch.add(sprites, id, enemy.renderRect(alpha), tint);
+                }
+                if (player1.isActive) batch.add(sprites, tankSprite(SpriteId::PLAYER1_UP, player1.lastDirX, player1.lastDirY, SpriteId::PLAYER1_UP), player1.renderRect(alpha));
+                if (numberOfPlayers == 2 && player2.isActive) batch.add(sprites, tankSprite(SpriteId::PLAYER2_UP, player2.lastDirX, player2.lastDirY, SpriteId::PLAYER2_UP), player2.renderRect(alpha));
+                for (int i = 0; i < bullets.count; ++i) if (bullets.alive[i]) batch.add(sprites, SpriteId::BULLET, bullets.renderRect(i, alpha));
+                batch.flush(renderer, sprites);
+                // Vẽ Bụi Cỏ (Sau cùng)
+                if (bushLayer && terrainCacheValid) SDL_RenderCopy(renderer, bushLayer, nullptr, nullptr);
+                else drawBushes();
+                if (currentState == GameState::LEVEL_TRANSITION) drawLevelBanner(); // Thế giới đứng yên phía sau
+                break;
+            }
+            case GameState::GAME_OVER: {
+                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderClear(renderer);
+                if (gameOverTexture) {
+                    int imgW, imgH; SDL_QueryTexture(gameOverTexture, NULL, NULL, &imgW, &imgH);
+                    SDL_Rect dstRect = {(SCREEN_WIDTH - imgW) / 2, (SCREEN_HEIGHT - imgH) / 2, imgW, imgH }; SDL_RenderCopy(renderer, gameOverTexture, NULL, &dstRect);
+                } else LOG_RATE_LIMITED(LogLevel::WARN, 5000, "Game Over texture missing.");
+                break;
+            }
+        }
+#if BATTLECITY_PROFILER
+        if (profilerOverlay) drawProfilerOverlay();
+#endif
+        SDL_RenderPresent(renderer);
+    } // End render()
+
+    // Nền xám, vùng chơi đen và mọi tường không phải bụi cỏ
+    void drawTerrainBase() {
+        SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255); SDL_RenderClear(renderer);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_Rect playableArea = {TILE_SIZE, TILE_SIZE, SCREEN_WIDTH - 2 * TILE_SIZE, SCREEN_HEIGHT - 2 * TILE_SIZE}; SDL_RenderFillRect(renderer, &playableArea);
+        for (auto &wall : walls) {
+            if (!wall.active || wall.type == WallType::BUSH) continue;
+            batch.add(sprites, wallSprite(wall.type), wall.rect);
+        }
+        batch.flush(renderer, sprites);
+    }
+
+    void drawBushes() {
+        for (auto &wall : walls) if (wall.active && wall.type == WallType::BUSH) batch.add(sprites, SpriteId::GRASS, wall.rect);
+        batch.flush(renderer, sprites);
+    }
+
+    static SpriteId wallSprite(WallType type) {
+        switch (type) { case WallType::BRICK: return SpriteId::BRICK; case WallType::STEEL: return SpriteId::STEEL; case WallType::WATER: return SpriteId::WATER; default: return SpriteId::GRASS; }
+    }
+
+    // Dựng lại lớp địa hình khi sang màn mới (hoặc mất render target), nếu không thì chỉ vá các ô bẩn
+    void refreshTerrainCache() {
+        if (!renderer) return;
+        if (!terrainLayer) {
+            if (!SDL_RenderTargetSupported(renderer)) return; // Dùng đường vẽ trực tiếp
+            terrainLayer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+            bushLayer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+            if (!terrainLayer || !bushLayer) {
+                LOG_WARN("Terrain cache disabled: %s", SDL_GetError());
+                if (terrainLayer) SDL_DestroyTexture(terrainLayer);
+                if (bushLayer) SDL_DestroyTexture(bushLayer);
+                terrainLayer = bushLayer = nullptr; return;
+            }
+            SDL_SetTextureBlendMode(bushLayer, SDL_BLENDMODE_BLEND);
+            terrainCacheValid = false;
+        }
+
+        if (!terrainCacheValid) {
+            SDL_SetRenderTarget(renderer, terrainLayer); drawTerrainBase();
+            SDL_SetRenderTarget(renderer, bushLayer); SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0); SDL_RenderClear(renderer); drawBushes();
+            SDL_SetRenderTarget(renderer, nullptr);
+            terrainCacheValid = true;
+            memset(dirtyTerrainRows, 0, sizeof(dirtyTerrainRows));
+            return;
+        }
+
+        bool targetSet = false;
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        for (int r = 0; r < MAP_HEIGHT; ++r) {
+            if (!dirtyTerrainRows[r]) continue;
+            if (!targetSet) { SDL_SetRenderTarget(renderer, terrainLayer); targetSet = true; }
+            for (int c = 0; c < MAP_WIDTH; ++c) {
+                if (!(dirtyTerrainRows[r] & ((Uint64)1 << c))) continue;
+                SDL_Rect tile = {c * TILE_SIZE, r * TILE_SIZE, TILE_SIZE, TILE_SIZE};
+                SDL_RenderFillRect(renderer, &tile);
+                for (WallType t : {WallType::WATER, WallType::STEEL, WallType::BRICK}) if (terrain.has(t, c, r)) batch.add(sprites, wallSprite(t), tile);
+            }
+            dirtyTerrainRows[r] = 0;
+        }
+        if (targetSet) { batch.flush(renderer, sprites); SDL_SetRenderTarget(renderer, nullptr); }
+    }
+
+    // Chữ phông 3x5, mỗi điểm ảnh là một ô scale x scale; ký tự không có trong phông được bỏ trống
+    void appendDebugText(int x, int y, const char* text, int scale) {
+        for (; *text; ++text, x += 4 * scale) {
+            const char* found = strchr(DEBUG_FONT_CHARS, toupper((unsigned char)*text));
+            if (*text == ' ' || !found) continue;
+            Uint16 glyph = DEBUG_FONT_GLYPHS[found - DEBUG_FONT_CHARS];
+            for (int bitIndex = 0; bitIndex < 15; ++bitIndex)
+                if (glyph & (1 << (14 - bitIndex))) overlayRects.push_back({x + (bitIndex % 3) * scale, y + (bitIndex / 3) * scale, scale, scale});
+        }
+    }
+
+    // Dải tối giữa màn hình với "LEVEL N CLEARED" hoặc "YOU WIN" trong lúc chuyển màn
+    void drawLevelBanner() {
+        const int TEXT_SCALE = 8, BAND_HEIGHT = 5 * TEXT_SCALE + 48;
+        char text[32];
+        if (transitionNextLevel == 0) snprintf(text, sizeof(text), "YOU WIN");
+        else snprintf(text, sizeof(text), "LEVEL %d CLEARED", currentLevel);
+        int textW = (int)strlen(text) * 4 * TEXT_SCALE - TEXT_SCALE;
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 180);
+        SDL_Rect band = {0, (SCREEN_HEIGHT - BAND_HEIGHT) / 2, SCREEN_WIDTH, BAND_HEIGHT}; SDL_RenderFillRect(renderer, &band);
+        overlayRects.clear();
+        appendDebugText((SCREEN_WIDTH - textW) / 2, (SCREEN_HEIGHT - 5 * TEXT_SCALE) / 2, text, TEXT_SCALE);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderFillRects(renderer, overlayRects.data(), (int)overlayRects.size());
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    }
+
+#if BATTLECITY_PROFILER
+    // Biểu đồ thời gian khung (xếp chồng events/update/render, phần còn lại là chờ vsync), vạch 16.7 ms,
+    // p50/p99, trung bình từng pha và số thực thể
+    void drawProfilerOverlay() {
+        const int PANEL_X = 8, PANEL_Y = 8, BAR_WIDTH = 2, GRAPH_HEIGHT = 100, TEXT_SCALE = 2;
+        const double PX_PER_MS = 3.0;
+        const int panelW = PROFILER_FRAMES * BAR_WIDTH + 16, panelH = GRAPH_HEIGHT + 16 + 5 * 6 * TEXT_SCALE;
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 180);
+        SDL_Rect panel = {PANEL_X, PANEL_Y, panelW, panelH}; SDL_RenderFillRect(renderer, &panel);
+
+        struct Layer { ProfilePhase phase; SDL_Color color; };
+        static const Layer layers[] = { {ProfilePhase::EVENTS, {80, 160, 255, 255}}, {ProfilePhase::UPDATE, {80, 220, 80, 255}}, {ProfilePhase::RENDER, {255, 170, 40, 255}} };
+        int graphBottom = PANEL_Y + 8 + GRAPH_HEIGHT;
+        int count = profiler.frameCountRecorded();
+        for (const Layer* layer = layers; layer <= layers + 3; ++layer) { // Lượt cuối (layer == layers + 3): phần chờ còn lại
+            overlayRects.clear();
+            for (int i = 0; i < count; ++i) {
+                const Profiler::Frame& f = profiler.frame(i);
+                double below = 0.0;
+                for (const Layer* l = layers; l < layer; ++l) below += f.phaseNs[(int)l->phase] / 1e6;
+                double ms = (layer < layers + 3) ? f.phaseNs[(int)layer->phase] / 1e6 : max(0.0, f.phaseNs[(int)ProfilePhase::FRAME] / 1e6 - below);
+                int y0 = (int)min((double)GRAPH_HEIGHT, below * PX_PER_MS), y1 = (int)min((double)GRAPH_HEIGHT, (below + ms) * PX_PER_MS);
+                if (y1 > y0) overlayRects.push_back({PANEL_X + 8 + i * BAR_WIDTH, graphBottom - y1, BAR_WIDTH, y1 - y0});
+            }
+            SDL_Color c = (layer < layers + 3) ? layer->color : SDL_Color{110, 110, 110, 255};
+            SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
+            if (!overlayRects.empty()) SDL_RenderFillRects(renderer, overlayRects.data(), (int)overlayRects.size());
+        }
+        SDL_SetRenderDrawColor(renderer, 255, 60, 60, 255); // Ngân sách 60 FPS
+        int budgetY = graphBottom - (int)(1000.0 / 60.0 * PX_PER_MS);
+        SDL_RenderDrawLine(renderer, PANEL_X + 8, budgetY, PANEL_X + 8 + PROFILER_FRAMES * BAR_WIDTH, budgetY);
+
+        char line[128]; int textY = graphBottom + 8; const int lineStep = 6 * TEXT_SCALE;
+        overlayRects.clear();
+        snprintf(line, sizeof(line), "FRAME P50 %.1f P99 %.1f MS", profiler.phasePercentileMs(ProfilePhase::FRAME, 0.5), profiler.phasePercentileMs(ProfilePhase::FRAME, 0.99));
+        appendDebugText(PANEL_X + 8, textY, line, TEXT_SCALE); textY += lineStep;
+        snprintf(line, sizeof(line), "UPDATE %.2f AI %.2f COLLISION %.2f MS", profiler.phaseAverageMs(ProfilePhase::UPDATE), profiler.phaseAverageMs(ProfilePhase::AI), profiler.phaseAverageMs(ProfilePhase::COLLISION));
+        appendDebugText(PANEL_X + 8, textY, line, TEXT_SCALE); textY += lineStep;
+        snprintf(line, sizeof(line), "EVENTS %.2f RENDER %.2f MS", profiler.phaseAverageMs(ProfilePhase::EVENTS), profiler.phaseAverageMs(ProfilePhase::RENDER));
+        appendDebugText(PANEL_X + 8, textY, line, TEXT_SCALE); textY += lineStep;
+        snprintf(line, sizeof(line), "ENEMIES %d BULLETS %d", enemies.size(), bullets.count);
+        appendDebugText(PANEL_X + 8, textY, line, TEXT_SCALE); textY += lineStep;
+        appendDebugText(PANEL_X + 8, textY, "F3 HIDE  F4 SAVE TRACE", TEXT_SCALE);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderFillRects(renderer, overlayRects.data(), (int)overlayRects.size());
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    }
+#endif
+
+    // Vòng lặp bước cố định: mô phỏng luôn chạy TICKS_PER_SECOND tick/giây thời gian thật,
+    // còn tốc độ vẽ do vsync (hoặc không giới hạn) quyết định; vị trí được nội suy giữa hai tick.
+    void run() {
+        const double TICK_SECONDS = 1.0 / TICKS_PER_SECOND;
+        const double MAX_FRAME_SECONDS = 0.25; // Chặn bước nhảy lớn (cửa sổ bị kéo, máy bị treo tạm thời)
+        const int MAX_TICKS_PER_FRAME = 8;
+        const double counterFreq = (double)SDL_GetPerformanceFrequency();
+        Uint64 previousCounter = SDL_GetPerformanceCounter();
+        double accumulator = 0.0;
+        LOG_INFO("Starting Game Loop...");
+        while (running) {
+            Uint64 currentCounter = SDL_GetPerformanceCounter();
+            double frameSeconds = (currentCounter - previousCounter) / counterFreq;
+            previousCounter = currentCounter;
+            accumulator += min(frameSeconds, MAX_FRAME_SECONDS);
+
+            profiler.beginFrame();
+            { PROFILE_SCOPE(profiler, ProfilePhase::EVENTS); handleEvents(); }
+            int ticksThisFrame = 0;
+            while (accumulator >= TICK_SECONDS && ticksThisFrame < MAX_TICKS_PER_FRAME) {
+                update(); sounds.flush(); accumulator -= TICK_SECONDS; ticksThisFrame++;
+            }
+            if (ticksThisFrame == MAX_TICKS_PER_FRAME) accumulator = min(accumulator, TICK_SECONDS); // Máy quá chậm: bỏ bớt thời gian tồn đọng
+            render((float)(accumulator / TICK_SECONDS));
+            profiler.endFrame(enemies.size(), bullets.count);
+        }
+        LOG_INFO("Exiting Game Loop.");
+        finishRecording();
+    } // End run()
+
+}; // End class Game
+
+
+// =============================================================================
+// == Chạy Hàng Loạt Trận AI-vs-AI Không Giao Diện (headless) ==
+// =============================================================================
+struct BatchOptions {
+    int matches = 100;
+    int players = 1;
+    int startLevel = 1;
+    Uint32 maxTicksPerMatch = 60 * TICKS_PER_SECOND * 10; // 10 phút thời gian game
+    unsigned seed = 0; // 0 = lấy theo time()
+    int aiThreads = 0; // Luồng phụ cho pha AI của địch; kết quả không phụ thuộc giá trị này
+    const char* tracePath = nullptr; // Khác null: ghi các pha update/AI/va chạm và xuất trace khi xong
+    Uint32 mapSeed = 0; // Khác 0: chơi bản đồ cố định của seed này ở mọi màn
+};
+
+int runHeadlessBatch(const BatchOptions& opt) {
+    Game game(true, true, opt.aiThreads);
+    game.rng.seed(opt.seed ? opt.seed : (Uint64)time(0));
+    game.profiler.active = (opt.tracePath != nullptr);
+    game.fixedMapSeed = opt.mapSeed;
+    long long totalTicks = 0; int wins = 0, losses = 0, timeouts = 0; long long levelSum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int m = 0; m < opt.matches; ++m) {
+        game.startMatch(opt.players, opt.startLevel);
+        Uint32 ticks = 0;
+        while (!game.matchOver && ticks < opt.maxTicksPerMatch) { game.update(); ticks++; }
+        totalTicks += ticks; levelSum += game.currentLevel;
+        if (game.matchWon) wins++; else if (game.matchOver) losses++; else timeouts++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    cout << "Headless batch: " << opt.matches << " matches (" << opt.players << "P, start level " << opt.startLevel << ")\n"
+         << "  wins " << wins << ", losses " << losses << ", timeouts " << timeouts
+         << ", avg level reached " << (opt.matches ? (double)levelSum / opt.matches : 0.0) << "\n"
+         << "  total ticks " << totalTicks << " in " << seconds << " s\n"
+         << "  ticks/second: " << (seconds > 0 ? totalTicks / seconds : 0.0) << endl;
+    if (opt.tracePath) {
+        if (!game.profiler.exportTrace(opt.tracePath)) { cerr << "Failed to write " << opt.tracePath << endl; return 1; }
+        cout << "  trace (last " << PROFILER_EVENTS << " events) written to " << opt.tracePath << endl;
+    }
+    return 0;
+}
+
+// =============================================================================
+// == Phát Lại Bản Ghi (--replay) ==
+// =============================================================================
+// Chạy lại một file --record không giao diện, hết tốc độ. Chuyển màn vẫn đi qua LEVEL_TRANSITION như
+// bản cửa sổ (chỉ không vẽ) để số tick khớp với bản ghi. Trả 2 nếu mã băm trạng thái cuối khác.
+int runReplay(const char* path, const char* tracePath) {
+    InputRecording recording;
+    if (!recording.load(path)) { cerr << "ERROR: Cannot read replay " << path << endl; return 1; }
+    const ReplayHeader& h = recording.header;
+    Game game(true);
+    game.autoPlayers = false; game.instantTransitions = false;
+    game.profiler.active = (tracePath != nullptr);
+    game.fixedMapSeed = h.mapSeed; game.rng.state = h.rngState;
+    game.replayInput = &recording;
+    game.startMatch((int)h.players, (int)h.startLevel);
+    auto t0 = std::chrono::steady_clock::now();
+    Uint32 ticks = 0;
+    for (; ticks < h.tickCount && game.running; ++ticks) game.update();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    Uint64 hash = game.stateHash();
+    cout << "Replay " << path << ": " << h.players << "P from level " << h.startLevel << ", " << ticks << " ticks, "
+         << recording.runs.size() << " input runs\n"
+         << "  reached level " << game.currentLevel << (game.matchWon ? " (won)" : game.matchOver ? " (game over)" : "") << "\n"
+         << "  " << seconds << " s, ticks/second: " << (seconds > 0 ? ticks / seconds : 0.0) << "\n"
+         << "  final state " << (hash == h.finalHash ? "matches recording" : "DIFFERS from recording") << endl;
+    if (tracePath) {
+        if (!game.profiler.exportTrace(tracePath)) { cerr << "Failed to write " << tracePath << endl; return 1; }
+        cout << "  trace (last " << PROFILER_EVENTS << " events) written to " << tracePath << endl;
+    }
+    return hash == h.finalHash ? 0 : 2;
+}
+
+// =============================================================================
+// == Máy Chủ Và Client Mạng (--server, --connect) ==
+// =============================================================================
+struct NetServerOptions {
+    Uint16 port = NET_DEFAULT_PORT;
+    int players = 2;
+    int startLevel = 1;
+    unsigned seed = 1;
+    Uint32 mapSeed = 0;
+    NetConditions conditions;
+};
 
-    // Textures
-    SDL_Texture* menuTexture = nullptr;
-    SDL_Texture* brickTexture = nullptr; SDL_Texture* steelTexture = nullptr; SDL_Texture* waterTexture = nullptr; SDL_Texture* grassTexture = nullptr;
-    SDL_Texture* bulletTexture = nullptr;
-    SDL_Texture* player1TankUpTexture = nullptr; SDL_Texture* player1TankDownTexture = nullptr; SDL_Texture* player1TankLeftTexture = nullptr; SDL_Texture* player1TankRightTexture = nullptr;
-    SDL_Texture* player2TankUpTexture = nullptr; SDL_Texture* player2TankDownTexture = nullptr; SDL_Texture* player2TankLeftTexture = nullptr; SDL_Texture* player2TankRightTexture = nullptr;
-    SDL_Texture* enemyTank2UpTexture = nullptr; SDL_Texture* enemyTank2DownTexture = nullptr; SDL_Texture* enemyTank2LeftTexture = nullptr; SDL_Texture* enemyTank2RightTexture = nullptr;
-    SDL_Texture* enemyTank3UpTexture = nullptr; SDL_Texture* enemyTank3DownTexture = nullptr; SDL_Texture* enemyTank3LeftTexture = nullptr; SDL_Texture* enemyTank3RightTexture = nullptr;
-    SDL_Texture* gameOverTexture = nullptr;
+struct NetPeer {
+    sockaddr_in address;
+    bool connected = false;
+    Uint8 masks[NET_SNAPSHOT_HISTORY] = {}; // Theo số thứ tự % NET_SNAPSHOT_HISTORY
+    Uint32 newestSeq = 0, nextSeq = 1;      // Đầu vào mới nhất đã nhận / kế tiếp sẽ áp dụng
+    Uint8 lastMask = 0;
+    Uint32 ackFrame = 0, lastHeardMs = 0;
+    Uint32 minBacklog = ~0u; int backlogTicks = 0; // Tồn đọng nhỏ nhất trong cửa sổ đo hiện tại
+    Uint64 bytesReceived = 0, snapshotBytes = 0, snapshotsSent = 0, inputsMissed = 0;
+    int largestSnapshot = 0, mostParts = 0; // Khung lớn nhất (byte, tổng các phần) / nhiều phần nhất
 
-    // Sounds
-    Mix_Chunk* bulletShotSound = nullptr; Mix_Chunk* tankBrokenSound = nullptr; Mix_Chunk* gameOverSound = nullptr; Mix_Chunk* levelUpSound = nullptr; Mix_Chunk* playerDestroySound = nullptr;
+    // Mặt nạ cho tick này. Thiếu (trễ/mất gói) thì giữ hướng cũ, không bắn. Hàng đợi chỉ sâu tới mức
+    // jitter cần: tồn đọng quá NET_INPUT_BUFFER_MAX, hoặc suốt một giây không lúc nào dưới 2, thì bỏ bớt
+    // mặt nạ cũ nhưng gộp bit bắn của chúng để không mất lần bắn nào
+    Uint8 consume() {
+        if (nextSeq > newestSeq) { inputsMissed++; minBacklog = 0; return lastMask & ~INPUT_FIRE; }
+        Uint32 backlog = newestSeq - nextSeq + 1, keep = min(backlog, (Uint32)NET_INPUT_BUFFER_MAX);
+        minBacklog = min(minBacklog, backlog);
+        if (++backlogTicks >= TICKS_PER_SECOND) { if (minBacklog > 1) keep = min(keep, backlog - (minBacklog - 1)); minBacklog = ~0u; backlogTicks = 0; }
+        Uint8 fire = 0;
+        for (; newestSeq - nextSeq + 1 > keep; nextSeq++) fire |= masks[nextSeq % NET_SNAPSHOT_HISTORY] & INPUT_FIRE;
+        lastMask = masks[nextSeq++ % NET_SNAPSHOT_HISTORY] | fire;
+        return lastMask;
+    }
+};
 
-    Game() : player1(), player2() {
-        cout << "Initializing Game..." << endl;
-        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) { cerr << "SDL Init Error: " << SDL_GetError() << endl; running = false; return; }
-        cout << "SDL Initialized." << endl;
-        int imgFlags = IMG_INIT_PNG | IMG_INIT_JPG;
-        if (!(IMG_Init(imgFlags) & imgFlags)) { cerr << "SDL_image Error: " << IMG_GetError() << endl; running = false; SDL_Quit(); return; }
-        cout << "SDL_image Initialized." << endl;
-        if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) { cerr << "Warning: SDL_mixer Error: " << Mix_GetError() << endl; } else { cout << "SDL_mixer Initialized." << endl; }
+// Trạng thái phía máy chủ: socket, người chơi đã vào, lịch sử ảnh chụp đã gửi (gốc cho delta)
+class NetServer {
+public:
+    UdpSocket socket;
+    NetConditioner link;
+    NetPeer peers[2];
+    int players = 2, joined = 0;
+    bool started = false;
+    Uint32 frame = 0; // Khung ảnh chụp gửi gần nhất (0 = chưa gửi)
 
-        window = SDL_CreateWindow("Battle City Clone - Select Mode", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-        if (!window) { cerr << "Window Creation Error: " << SDL_GetError() << endl; running = false; Mix_Quit(); IMG_Quit(); SDL_Quit(); return; }
-        cout << "Window Created." << endl;
+    NetServer() : packets((size_t)NET_SNAPSHOT_MAX_PARTS * NET_MAX_DATAGRAM) { delta.reserve(sizeof(WorldSnapshot)); }
 
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-        if (!renderer) { cerr << "Renderer Creation Error: " << SDL_GetError() << endl; running = false; SDL_DestroyWindow(window); Mix_Quit(); IMG_Quit(); SDL_Quit(); return; }
-        cout << "Renderer Created." << endl;
+    bool open(Uint16 port) { return socket.open(port); }
 
-        currentState = GameState::SELECT_MODE;
-        if (!loadMedia()) { cerr << "ERROR: Failed to load essential media! Exiting." << endl; running = false; SDL_DestroyRenderer(renderer); SDL_DestroyWindow(window); Mix_Quit(); IMG_Quit(); SDL_Quit(); return; }
-        srand(time(0));
-        cout << "Game Initialized Successfully. Showing Menu." << endl;
+    // Nhận mọi gói đang chờ: HELLO (vào trận trước khi bắt đầu), INPUT (mặt nạ + xác nhận khung), BYE
+    void poll(Uint32 now) {
+        Uint8 buffer[NET_MAX_DATAGRAM]; sockaddr_in from;
+        for (int n; (n = socket.receive(buffer, sizeof(buffer), from)) >= 0; ) {
+            if (n < (int)sizeof(NetHeader)) continue;
+            NetHeader h; memcpy(&h, buffer, sizeof(h));
+            if (h.magic != NET_MAGIC) continue;
+            int slot = -1;
+            for (int i = 0; i < joined; ++i) if (sameAddress(peers[i].address, from)) slot = i;
+            if (h.type == NetPacket::HELLO) {
+                if (slot < 0 && !started && joined < players) {
+                    slot = joined++; peers[slot].address = from; peers[slot].connected = true;
+                    cout << "Player " << slot + 1 << " joined from " << inet_ntoa(from.sin_addr) << ":" << ntohs(from.sin_port) << endl;
+                }
+                if (slot >= 0) { NetWelcomePacket w = {{NET_MAGIC, NetPacket::WELCOME, (Uint8)slot}, (Uint8)players}; link.send(socket, (const Uint8*)&w, sizeof(w), from); }
+                if (slot >= 0) peers[slot].lastHeardMs = now;
+                continue;
+            }
+            if (slot < 0) continue;
+            NetPeer& peer = peers[slot];
+            peer.lastHeardMs = now; peer.bytesReceived += (Uint64)n + 28;
+            if (h.type == NetPacket::BYE) { peer.connected = false; cout << "Player " << slot + 1 << " left." << endl; continue; }
+            if (h.type != NetPacket::INPUT || n < (int)sizeof(NetInputPacket)) continue;
+            NetInputPacket in; memcpy(&in, buffer, sizeof(in));
+            for (int i = 0; i < in.count && i < NET_INPUT_REDUNDANCY && in.newestSeq >= (Uint32)i; ++i) {
+                Uint32 seq = in.newestSeq - i;
+                if (seq >= peer.nextSeq && seq < peer.nextSeq + NET_SNAPSHOT_HISTORY) peer.masks[seq % NET_SNAPSHOT_HISTORY] = in.masks[i];
+            }
+            if (in.newestSeq > peer.newestSeq && in.newestSeq < peer.nextSeq + NET_SNAPSHOT_HISTORY) peer.newestSeq = in.newestSeq;
+            if (in.ackFrame > peer.ackFrame && in.ackFrame <= frame) peer.ackFrame = in.ackFrame;
+        }
     }
 
-    ~Game() {
-        cout << "Cleaning Game Resources..." << endl;
-        if(menuTexture) SDL_DestroyTexture(menuTexture); if(brickTexture) SDL_DestroyTexture(brickTexture); if(steelTexture) SDL_DestroyTexture(steelTexture); if(waterTexture) SDL_DestroyTexture(waterTexture); if(grassTexture) SDL_DestroyTexture(grassTexture); if(bulletTexture) SDL_DestroyTexture(bulletTexture);
-        if(player1TankUpTexture) SDL_DestroyTexture(player1TankUpTexture); if(player1TankDownTexture) SDL_DestroyTexture(player1TankDownTexture); if(player1TankLeftTexture) SDL_DestroyTexture(player1TankLeftTexture); if(player1TankRightTexture) SDL_DestroyTexture(player1TankRightTexture);
-        if(player2TankUpTexture) SDL_DestroyTexture(player2TankUpTexture); if(player2TankDownTexture) SDL_DestroyTexture(player2TankDownTexture); if(player2TankLeftTexture) SDL_DestroyTexture(player2TankLeftTexture); if(player2TankRightTexture) SDL_DestroyTexture(player2TankRightTexture);
-        if(enemyTank2UpTexture) SDL_DestroyTexture(enemyTank2UpTexture); if(enemyTank2DownTexture) SDL_DestroyTexture(enemyTank2DownTexture); if(enemyTank2LeftTexture) SDL_DestroyTexture(enemyTank2LeftTexture); if(enemyTank2RightTexture) SDL_DestroyTexture(enemyTank2RightTexture);
-        if(enemyTank3UpTexture) SDL_DestroyTexture(enemyTank3UpTexture); if(enemyTank3DownTexture) SDL_DestroyTexture(enemyTank3DownTexture); if(enemyTank3LeftTexture) SDL_DestroyTexture(enemyTank3LeftTexture); if(enemyTank3RightTexture) SDL_DestroyTexture(enemyTank3RightTexture);
-        if(gameOverTexture) SDL_DestroyTexture(gameOverTexture);
-        if(bulletShotSound) Mix_FreeChunk(bulletShotSound); if(tankBrokenSound) Mix_FreeChunk(tankBrokenSound); if(gameOverSound) Mix_FreeChunk(gameOverSound); if(levelUpSound) Mix_FreeChunk(levelUpSound); if(playerDestroySound) Mix_FreeChunk(playerDestroySound);
-        if (renderer) SDL_DestroyRenderer(renderer); if (window) SDL_DestroyWindow(window);
-        Mix_CloseAudio(); Mix_Quit(); IMG_Quit(); SDL_Quit();
-        cout << "Game Resources Cleaned." << endl;
+    void start() {
+        for (int i = 0; i < joined; ++i) peers[i].nextSeq = peers[i].newestSeq + 1; // Đầu vào lúc chờ không tính
+        started = true;
     }
 
-    Mix_Chunk* loadSound(const std::string& path) {
-        Mix_Chunk* chunk = Mix_LoadWAV(path.c_str());
-        if (!chunk) cerr << "Failed to load sound: " << path << " - " << Mix_GetError() << endl;
-        else cout << "Loaded sound: " << path << endl;
-        return chunk;
+    // Chụp trạng thái sau tick vừa chạy thành khung mới và gửi cho từng người chơi còn kết nối
+    void broadcast(const Game& game) {
+        frame++;
+        WorldSnapshot& current = history[frame % NET_SNAPSHOT_HISTORY];
+        bool captured = game.captureSnapshot(current);
+        historyFrame[frame % NET_SNAPSHOT_HISTORY] = captured ? frame : 0; // Ô lịch sử không còn giữ khung hợp lệ nào
+        if (!captured) { LOG_RATE_LIMITED(LogLevel::WARN, 5000, "World too large for a network snapshot, frame %u not sent.", frame); return; }
+        for (int i = 0; i < joined; ++i) if (peers[i].connected) sendSnapshot(i, current);
     }
 
-    bool loadMedia() {
-         cout << "Loading media..." << endl; bool essential_success = true;
-         menuTexture = loadTexture("giao_dien.jpg", renderer); if (!menuTexture) return false; else cout << "Loaded texture: giao_dien.jpg" << endl;
-         brickTexture = loadTexture("brick.png", renderer); if (!brickTexture) essential_success = false;
-         steelTexture = loadTexture("steel.png", renderer); if (!steelTexture) essential_success = false;
-         waterTexture = loadTexture("water.png", renderer); if (!waterTexture) essential_success = false;
-         grassTexture = loadTexture("grass.png", renderer); if (!grassTexture) cerr << "Warning: Failed to load grass.png" << endl;
-         bulletTexture = loadTexture("Bullet.png", renderer); if (!bulletTexture) essential_success = false;
-         player1TankUpTexture = loadTexture("tank1U.png", renderer); if (!player1TankUpTexture) essential_success = false; player1TankDownTexture = loadTexture("tank1D.png", renderer); if (!player1TankDownTexture) essential_success = false; player1TankLeftTexture = loadTexture("tank1L.png", renderer); if (!player1TankLeftTexture) essential_success = false; player1TankRightTexture = loadTexture("tank1R.png", renderer); if (!player1TankRightTexture) essential_success = false;
-         player2TankUpTexture = loadTexture("tank_player2U.png", renderer); if (!player2TankUpTexture) essential_success = false; player2TankDownTexture = loadTexture("tank_player2D.png", renderer); if (!player2TankDownTexture) essential_success = false; player2TankLeftTexture = loadTexture("tank_player2L.png", renderer); if (!player2TankLeftTexture) essential_success = false; player2TankRightTexture = loadTexture("tank_player2R.png", renderer); if (!player2TankRightTexture) essential_success = false;
-         enemyTank2UpTexture = loadTexture("tank2U.png", renderer); if (!enemyTank2UpTexture) essential_success = false; enemyTank2DownTexture = loadTexture("tank2D.png", renderer); if (!enemyTank2DownTexture) essential_success = false; enemyTank2LeftTexture = loadTexture("tank2L.png", renderer); if (!enemyTank2LeftTexture) essential_success = false; enemyTank2RightTexture = loadTexture("tank2R.png", renderer); if (!enemyTank2RightTexture) essential_success = false;
-         enemyTank3UpTexture = loadTexture("tank3U.png", renderer); if (!enemyTank3UpTexture) essential_success = false; enemyTank3DownTexture = loadTexture("tank3D.png", renderer); if (!enemyTank3DownTexture) essential_success = false; enemyTank3LeftTexture = loadTexture("tank3L.png", renderer); if (!enemyTank3LeftTexture) essential_success = false; enemyTank3RightTexture = loadTexture("tank3R.png", renderer); if (!enemyTank3RightTexture) essential_success = false;
-         gameOverTexture = loadTexture("game_over.png", renderer); if (!gameOverTexture) cerr << "Warning: Failed to load game_over.png!" << endl;
-         bulletShotSound = loadSound("bullet_shot.wav"); tankBrokenSound = loadSound("broken.wav"); playerDestroySound = loadSound("broken.wav"); gameOverSound = loadSound("game_over.wav"); levelUpSound = loadSound("level_up.wav");
-         if (!essential_success) cerr << "ERROR: Failed to load one or more essential game textures!\n";
-         cout << "Media loading finished." << endl; return essential_success;
-    }
+    // Ảnh chụp đã gửi ở khung f, nullptr nếu lịch sử không còn giữ
+    const WorldSnapshot* sentSnapshot(Uint32 f) const { return (f && historyFrame[f % NET_SNAPSHOT_HISTORY] == f) ? &history[f % NET_SNAPSHOT_HISTORY] : nullptr; }
 
-    void setupLevel(int level) {
-        cout << "Loading Level " << level << "..." << endl; currentLevel = level;
-        string title = "Battle City Clone - Level " + to_string(level) + " (" + to_string(numberOfPlayers) + "P)"; SDL_SetWindowTitle(window, title.c_str());
-        walls.clear(); enemies.clear(); generateWalls(level);
-        player1.reset(((MAP_WIDTH / 2) - 2) * TILE_SIZE, (MAP_HEIGHT - 2) * TILE_SIZE);
-        if (numberOfPlayers == 2) player2.reset(((MAP_WIDTH / 2) + 1) * TILE_SIZE, (MAP_HEIGHT - 2) * TILE_SIZE); else player2.isActive = false;
-        if (level==1) enemiesToSpawn=10; else if (level==2) enemiesToSpawn=15; else if (level==3) enemiesToSpawn=20; else if (level==4) enemiesToSpawn=25; else if (level==5) enemiesToSpawn=30; else enemiesToSpawn=30+(level-5)*5;
-        if (level==1) maxEnemiesOnScreen=4; else if (level<=3) maxEnemiesOnScreen=5; else maxEnemiesOnScreen=6+(level-5)/2;
-        if (level==1) toughEnemiesToSpawnThisLevel=0; else if (level==2) toughEnemiesToSpawnThisLevel=1; else if (level==3) toughEnemiesToSpawnThisLevel=3; else if (level==4) toughEnemiesToSpawnThisLevel=7; else if (level==5) toughEnemiesToSpawnThisLevel=10; else toughEnemiesToSpawnThisLevel=10+(level-5)*2;
-        toughEnemiesSpawnedThisLevel = 0; enemiesOnScreen = 0;
-        spawnInitialEnemies(); SDL_Delay(100); cout << "Level " << level << " Started." << endl;
+private:
+    std::unique_ptr<WorldSnapshot[]> history{new WorldSnapshot[NET_SNAPSHOT_HISTORY]};
+    Uint32 historyFrame[NET_SNAPSHOT_HISTORY] = {};
+    vector<Uint8> delta, packets; // packets: NET_SNAPSHOT_MAX_PARTS ô NET_MAX_DATAGRAM byte
+
+    // Mọi phần của một khung mã hóa so với cùng một gốc, mỗi phần vừa một datagram, nên khung lớn (cả trạng
+    // thái gửi cho người chơi chưa xác nhận khung nào, ở màn nhiều địch) vẫn tới nơi thay vì bị bỏ
+    void sendSnapshot(int slot, const WorldSnapshot& current) {
+        NetPeer& peer = peers[slot];
+        Uint32 base = peer.ackFrame;
+        if (base == 0 || frame - base >= (Uint32)NET_SNAPSHOT_HISTORY || historyFrame[base % NET_SNAPSHOT_HISTORY] != base) base = 0;
+        const WorldSnapshot& from = base ? history[base % NET_SNAPSHOT_HISTORY] : *NetClient::zeroSnapshot();
+        int parts = 0, sizes[NET_SNAPSHOT_MAX_PARTS];
+        for (int word = 0; parts == 0 || word < SNAPSHOT_WORDS; ++parts) { // Khung không đổi gì vẫn là một phần rỗng
+            word = encodeSnapshotDelta(from, current, delta, word, NET_MAX_DATAGRAM - sizeof(NetSnapshotPacket));
+            NetSnapshotPacket sp = {{NET_MAGIC, NetPacket::SNAPSHOT, (Uint8)slot}, frame, base, peer.nextSeq - 1, (Uint16)delta.size(), (Uint8)parts, 0};
+            Uint8* out = &packets[(size_t)parts * NET_MAX_DATAGRAM];
+            memcpy(out, &sp, sizeof(sp));
+            if (!delta.empty()) memcpy(out + sizeof(sp), delta.data(), delta.size());
+            sizes[parts] = (int)(sizeof(sp) + delta.size());
+        }
+        int frameBytes = 0;
+        for (int k = 0; k < parts; ++k) {
+            Uint8* out = &packets[(size_t)k * NET_MAX_DATAGRAM];
+            out[offsetof(NetSnapshotPacket, partCount)] = (Uint8)parts;
+            link.send(socket, out, sizes[k], peer.address);
+            frameBytes += sizes[k];
+        }
+        peer.snapshotBytes += (Uint64)frameBytes + 28 * parts; peer.snapshotsSent++;
+        peer.largestSnapshot = max(peer.largestSnapshot, frameBytes); peer.mostParts = max(peer.mostParts, parts);
     }
+};
 
-    // Hàm GenerateWalls giữ nguyên như cũ (rất phức tạp)
-    void generateWalls(int level) { walls.clear(); int baseCol = MAP_WIDTH / 2; int baseRow = MAP_HEIGHT - 2; int spawnRowTop = 1; auto isProtectedZone = [&](int r, int c) { if (r <= spawnRowTop + 2 && (c < 4 || c > MAP_WIDTH - 5)) return true; if (r >= baseRow - 1 && (c > baseCol - 3 && c < baseCol + 3)) return true; return false; }; for (int i = 0; i < MAP_HEIGHT; ++i) { walls.push_back(Wall(0, i * TILE_SIZE, WallType::STEEL)); walls.push_back(Wall((MAP_WIDTH - 1) * TILE_SIZE, i * TILE_SIZE, WallType::STEEL)); } for (int j = 1; j < MAP_WIDTH - 1; ++j) { walls.push_back(Wall(j * TILE_SIZE, 0, WallType::STEEL)); walls.push_back(Wall(j * TILE_SIZE, (MAP_HEIGHT - 1) * TILE_SIZE, WallType::STEEL)); } int wallDensityFactor = 28 + level * 2; int steelChance = 5 + level * 2; int waterChance = 3 + level * 2; int bushChance = (level >= 2) ? (level * 3) : 0; for (int i = spawnRowTop + 1; i < baseRow; ++i) { for (int j = 1; j < MAP_WIDTH - 1; ++j) { if (isProtectedZone(i, j)) continue; int placeRoll = rand() % wallDensityFactor; if (placeRoll < 10) { int typeRoll = rand() % 100; WallType currentType; bool placed = false; if (typeRoll < waterChance) { currentType = WallType::WATER; placed = true; } else if (typeRoll < waterChance + steelChance) { currentType = WallType::STEEL; placed = true; } else if (bushChance > 0 && typeRoll < waterChance + steelChance + bushChance) { currentType = WallType::BUSH; placed = true; } else { currentType = WallType::BRICK; placed = true; } if (placed) { walls.push_back(Wall(j * TILE_SIZE, i * TILE_SIZE, currentType)); } if (currentType != WallType::BUSH) { if (level > 2 && rand() % (8 - level + 1) == 0) { if (j + 1 < MAP_WIDTH - 1 && !isProtectedZone(i, j + 1)) walls.push_back(Wall((j + 1) * TILE_SIZE, i * TILE_SIZE, WallType::BRICK)); } if (level > 3 && rand() % (9 - level + 1) == 0) { if (i + 1 < baseRow && !isProtectedZone(i + 1, j)) walls.push_back(Wall(j * TILE_SIZE, (i + 1) * TILE_SIZE, WallType::BRICK)); } } } } } if (level >= 3) { for(int i=4; i<7; ++i) for(int j=4; j<7; ++j) if(!isProtectedZone(i,j) && rand()%2==0) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::STEEL)); } if (level >= 4) { for(int i=MAP_HEIGHT-6; i<MAP_HEIGHT-3; ++i) for(int j=MAP_WIDTH-7; j<MAP_WIDTH-4; ++j) if(!isProtectedZone(i,j) && rand()%2==0) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::WATER)); } if (level == 5) { for(int i = MAP_HEIGHT/2 - 1; i <= MAP_HEIGHT/2 + 1; ++i ) { for (int j = MAP_WIDTH/2 - 2; j <= MAP_WIDTH/2 + 2; ++j) { if (i == MAP_HEIGHT/2 && j == MAP_WIDTH/2) continue; if (!isProtectedZone(i,j)) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::STEEL)); } } } if (level >= 2 && level < 5) { for(int i = MAP_HEIGHT/2 - 2; i <= MAP_HEIGHT/2 + 2; ++i ) { for (int j = MAP_WIDTH/2 - 3; j <= MAP_WIDTH/2 + 3; ++j) { if (abs(i - MAP_HEIGHT/2) <=1 && abs(j-MAP_WIDTH/2) <=1) continue; if (!isProtectedZone(i,j) && rand()%4 == 0) { bool occupied = false; for(const auto& w : walls) { if (w.rect.x == j*TILE_SIZE && w.rect.y == i*TILE_SIZE && w.type != WallType::BUSH) { occupied = true; break; } } if (!occupied) walls.push_back(Wall(j*TILE_SIZE, i*TILE_SIZE, WallType::BUSH)); } } } } }
+int runNetServer(const NetServerOptions& opt) {
+    NetServer server; server.players = opt.players; server.link.conditions = opt.conditions;
+    if (!server.open(opt.port)) { cerr << "ERROR: Cannot bind UDP port " << opt.port << endl; return 1; }
+    Game game(true);
+    game.autoPlayers = false; game.instantTransitions = false; game.useNetworkInput = true;
+    game.fixedMapSeed = opt.mapSeed; game.rng.seed(opt.seed);
+    NetPeer* peers = server.peers;
+    cout << "Server listening on UDP port " << opt.port << ", waiting for " << opt.players << " player(s)..." << endl;
 
-    void spawnInitialEnemies() {
-        int count = 0;
-        while (count < maxEnemiesOnScreen && enemiesToSpawn > 0) {
-            if (!trySpawnOneEnemy()) {
-                cerr << "Warning: Could not spawn initial enemy." << endl; break;
-            } count++;
+    const auto tickDuration = std::chrono::microseconds(1000000 / TICKS_PER_SECOND);
+    auto nextTick = std::chrono::steady_clock::now();
+    Uint32 lastReportMs = netNowMs(), startMs = 0;
+    while (true) {
+        Uint32 now = netNowMs();
+        server.poll(now);
+        int joined = server.joined;
+
+        if (!server.started && joined == opt.players) {
+            server.start();
+            game.startMatch(opt.players, opt.startLevel);
+            startMs = now;
+            cout << "Match started: " << opt.players << "P from level " << opt.startLevel << endl;
         }
-    }
 
-    bool trySpawnOneEnemy() {
-        if (enemiesOnScreen >= maxEnemiesOnScreen || enemiesToSpawn <= 0) return false;
-        vector<pair<int, int>> spawnPoints = { {TILE_SIZE, TILE_SIZE}, {(MAP_WIDTH / 2 - 1) * TILE_SIZE, TILE_SIZE}, {(MAP_WIDTH - 2) * TILE_SIZE, TILE_SIZE} };
-        random_shuffle(spawnPoints.begin(), spawnPoints.end());
-        for (const auto& sp : spawnPoints) {
-            SDL_Rect spawnRect = {sp.first, sp.second, TILE_SIZE, TILE_SIZE};
-            bool canSpawn = true;
-            for (const auto& w : walls) if (w.active && w.type != WallType::BUSH && SDL_HasIntersection(&spawnRect, &w.rect)) { canSpawn = false; break; }
-            if (canSpawn && player1.isActive && SDL_HasIntersection(&spawnRect, &player1.rect)) canSpawn = false;
-            if (canSpawn && numberOfPlayers == 2 && player2.isActive && SDL_HasIntersection(&spawnRect, &player2.rect)) canSpawn = false;
-            if (canSpawn) for (const auto& e : enemies) if (e.active && SDL_HasIntersection(&spawnRect, &e.rect)) { canSpawn = false; break; }
-            if (canSpawn) {
-                int initialHP = 1;
-                if (toughEnemiesSpawnedThisLevel < toughEnemiesToSpawnThisLevel) { initialHP = TOUGH_ENEMY_HP; toughEnemiesSpawnedThisLevel++; }
-                enemies.push_back(EnemyTank(sp.first, sp.second, currentLevel, initialHP, bulletShotSound, tankBrokenSound));
-                enemiesOnScreen++; enemiesToSpawn--; return true;
+        if (server.started) {
+            Uint8 input[2] = {0, 0};
+            for (int i = 0; i < joined; ++i) input[i] = peers[i].consume();
+            game.networkInput = (Uint16)(input[0] | (input[1] << 8));
+            game.update();
+            server.broadcast(game);
+        }
+        server.link.flush(server.socket);
+
+        for (int i = 0; i < joined; ++i)
+            if (peers[i].connected && now - peers[i].lastHeardMs > NET_TIMEOUT_MS) { peers[i].connected = false; cout << "Player " << i + 1 << " timed out." << endl; }
+        bool anyConnected = false;
+        for (int i = 0; i < joined; ++i) anyConnected |= peers[i].connected;
+
+        bool finished = server.started && (game.matchOver || !game.running || !anyConnected);
+        if (server.started && (finished || now - lastReportMs >= 5000)) {
+            double seconds = max(0.001, (now - startMs) / 1000.0);
+            cout << "[" << server.frame << " ticks, level " << game.currentLevel << "]";
+            for (int i = 0; i < joined; ++i) {
+                const NetPeer& p = peers[i];
+                cout << "  P" << i + 1 << ": down " << p.snapshotBytes * 8 / 1000.0 / seconds << " kbit/s (avg "
+                     << (p.snapshotsSent ? p.snapshotBytes / p.snapshotsSent : 0) << " B, max " << p.largestSnapshot << " B in "
+                     << p.mostParts << " datagram(s)), up " << p.bytesReceived * 8 / 1000.0 / seconds << " kbit/s, missed inputs " << p.inputsMissed;
+            }
+            cout << endl;
+            lastReportMs = now;
+        }
+        if (finished) {
+            // Ảnh chụp cuối đã gửi ở trên; báo kết thúc vài lần phòng mất gói
+            for (int i = 0; i < joined; ++i) {
+                NetHeader bye = {NET_MAGIC, NetPacket::BYE, (Uint8)i};
+                for (int k = 0; k < 3; ++k) server.socket.sendTo((const Uint8*)&bye, sizeof(bye), peers[i].address);
             }
+            cout << "Match over at level " << game.currentLevel << " after " << server.frame << " ticks." << endl;
+            return 0;
         }
-        cerr << "Warning: Failed to find a free spawn point for enemy." << endl; return false;
+        nextTick += tickDuration;
+        std::this_thread::sleep_until(nextTick);
     }
+}
 
-    void handleEvents() {
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) { running = false; return; }
-            switch (currentState) {
-                case GameState::SELECT_MODE: handleMenuInput(event); break;
-                case GameState::PLAYING:     handleGameplayInput(event); break;
-                case GameState::GAME_OVER:   if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) running = false; break; // Cho phép thoát ở Game Over
-            }
+struct NetClientOptions {
+    const char* host = "127.0.0.1";
+    Uint16 port = NET_DEFAULT_PORT;
+    bool headless = false; // Không cửa sổ, đầu vào tự động; dùng để đo trên localhost
+    bool vsync = true;
+    int seconds = 0;       // > 0: tự thoát sau ngần ấy giây
+    unsigned seed = 1;     // Seed của đầu vào tự động
+    NetConditions conditions;
+};
+
+int runNetClient(const NetClientOptions& opt) {
+    NetClient net;
+    net.link.conditions = opt.conditions; net.scriptRng.seed(opt.seed);
+    if (!net.connect(opt.host, opt.port)) { cerr << "ERROR: Cannot reach " << opt.host << ":" << opt.port << endl; return 1; }
+    Uint32 startMs = netNowMs();
+    if (opt.headless) {
+        Game game(true);
+        game.netClient = &net;
+        const auto tickDuration = std::chrono::microseconds(1000000 / TICKS_PER_SECOND);
+        auto nextTick = std::chrono::steady_clock::now();
+        while (game.running && (opt.seconds <= 0 || netNowMs() - startMs < (Uint32)opt.seconds * 1000)) {
+            game.update();
+            nextTick += tickDuration;
+            std::this_thread::sleep_until(nextTick);
         }
+    } else {
+        Game game(false, opt.vsync);
+        if (!game.running) { LOG_ERROR("Game initialization failed. Exiting."); return 1; }
+        game.netClient = &net;
+        game.run();
     }
+    net.sendBye();
 
-    void handleMenuInput(const SDL_Event& event) {
-        if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
-            switch (event.key.keysym.sym) {
-                case SDLK_1: cout << "Selected 1 Player mode." << endl; numberOfPlayers = 1; currentState = GameState::PLAYING; setupLevel(1); break;
-                case SDLK_2: cout << "Selected 2 Players mode." << endl; numberOfPlayers = 2; currentState = GameState::PLAYING; setupLevel(1); break;
-                case SDLK_ESCAPE: running = false; break;
+    double seconds = max(0.001, (netNowMs() - startMs) / 1000.0);
+    vector<Uint32>& delays = net.confirmDelayMs;
+    double average = 0; Uint32 p95 = 0;
+    if (!delays.empty()) {
+        for (Uint32 d : delays) average += d;
+        average /= delays.size();
+        std::nth_element(delays.begin(), delays.begin() + delays.size() * 95 / 100, delays.end());
+        p95 = delays[delays.size() * 95 / 100];
+    }
+    cout << "Client (player " << net.slot + 1 << "): " << seconds << " s\n"
+         << "  down " << net.bytesReceived * 8 / 1000.0 / seconds << " kbit/s, up " << net.link.bytesSent * 8 / 1000.0 / seconds << " kbit/s"
+         << " (" << net.link.packetsDropped << " of " << net.link.packetsSent << " sent packets dropped by --net-loss)\n"
+         << "  snapshots: " << net.snapshotsReceived / seconds << "/s, " << net.snapshotsUndecodable << " undecodable\n"
+         << "  input-to-screen: own tank predicted same tick; server-confirmed avg " << average << " ms, p95 " << p95 << " ms" << endl;
+    return 0;
+}
+
+// =============================================================================
+// == Tự Kiểm Tra Mạng Trên Localhost (--net-selftest) ==
+// =============================================================================
+// NetServer và NetClient thật nói chuyện qua UDP loopback trong cùng tiến trình, chạy hết tốc độ (không
+// chờ theo đồng hồ). Hai bot chơi màn L (mặc định 20), đầu mỗi pha được lấp đủ maxEnemiesOnScreen xe địch
+// và mỗi xe một viên đạn: lượng thực thể lúc đông nhất của màn. Pha 1: client chưa gửi gì nên máy chủ
+// không có xác nhận nào, mỗi khung là cả trạng thái so với ảnh chụp toàn 0 và phải cắt thành nhiều
+// datagram. Pha 2: client gửi đầu vào kèm xác nhận, khung thành delta nhỏ. Mọi khung client ghép xong
+// phải trùng từng byte với ảnh chụp máy chủ đã gửi. Chỉ --net-loss có tác dụng (trễ thì cần đồng hồ
+// thật). Trả 1 nếu có khung lệch, pha nào không đồng bộ được khung nào, hoặc pha 1 không cần tới nhiều datagram.
+const int NET_SELFTEST_TICKS = 600; // Mỗi pha
+
+// Thêm xe địch vào các ô trống (hàng lẻ, cột lẻ) tới maxEnemiesOnScreen, rồi cho mỗi xe bắn một viên
+void crowdLevel(Game& g) {
+    for (int r = 1; r < MAP_HEIGHT - 1 && g.enemiesOnScreen < g.maxEnemiesOnScreen; r += 2)
+        for (int c = 1; c < MAP_WIDTH - 1 && g.enemiesOnScreen < g.maxEnemiesOnScreen; c += 2) {
+            SDL_Rect tile = {c * TILE_SIZE, r * TILE_SIZE, TILE_SIZE, TILE_SIZE};
+            if (g.terrain.tankBlockingRow(r) >> c & 1) continue;
+            if (SDL_HasIntersection(&tile, &g.player1.rect) || SDL_HasIntersection(&tile, &g.player2.rect)) continue;
+            bool occupied = false;
+            for (const EnemyHot& e : g.enemies.hot) occupied |= SDL_HasIntersection(&tile, &e.rect) == SDL_TRUE;
+            if (occupied) continue;
+            EnemyHandle h = g.enemies.spawn(tile.x, tile.y, g.currentLevel, g.rng.next(), 2);
+            g.enemies.cold[g.enemies.find(h)].id = g.nextEnemyId++;
+            g.enemiesOnScreen++;
+        }
+    for (int i = 0; i < g.enemies.size(); ++i) g.enemies.shoot(i, g.bullets);
+}
+
+int runNetSelfTest(int level, const NetConditions& conditions) {
+    NetServer server; server.players = 2;
+    server.link.conditions.lossPercent = conditions.lossPercent;
+    NetClient net;
+    if (!server.open(0) || !net.connect("127.0.0.1", server.socket.localPort())) { cerr << "ERROR: Cannot open loopback UDP sockets" << endl; return 1; }
+    net.sendHello();
+    server.poll(netNowMs());
+    server.joined = server.players; // Người chơi 2 do bot máy chủ lái, không cần client thứ hai
+    server.start();
+    net.poll();
+    if (!net.welcomed) { cerr << "ERROR: No welcome from loopback server" << endl; return 1; }
+
+    Game game(true);
+    game.rng.seed(1); game.startMatch(2, level);
+    int mismatches = 0;
+    for (int phase = 1; phase <= 2; ++phase) {
+        Uint64 receivedBefore = net.snapshotsReceived, sentBefore = server.peers[0].snapshotsSent;
+        server.peers[0].largestSnapshot = 0; server.peers[0].mostParts = 0;
+        int mostEnemies = 0;
+        crowdLevel(game);
+        for (int t = 0; t < NET_SELFTEST_TICKS; ++t) {
+            if (game.matchOver) { game.startMatch(2, level); crowdLevel(game); } // Bot thua sớm: chơi lại để đủ số khung
+            game.update();
+            mostEnemies = max(mostEnemies, game.enemies.size());
+            server.broadcast(game);
+            Uint32 before = net.latestFrame;
+            net.poll();
+            if (net.latestFrame != before) {
+                const WorldSnapshot* sent = server.sentSnapshot(net.latestFrame);
+                if (!sent || memcmp(sent, &net.latest(), sizeof(WorldSnapshot)) != 0) mismatches++;
             }
+            if (phase == 2) { net.sendInput(0); server.poll(netNowMs()); }
         }
+        const NetPeer& peer = server.peers[0];
+        Uint64 received = net.snapshotsReceived - receivedBefore;
+        cout << "phase " << phase << (phase == 1 ? " (no ack, full state)" : " (acked deltas)") << ": level " << game.currentLevel
+             << ", up to " << mostEnemies << " enemies, " << received << " of " << peer.snapshotsSent - sentBefore << " frames synced, largest frame "
+             << peer.largestSnapshot << " B in " << peer.mostParts << " datagram(s)" << endl;
+        if (received == 0) { cout << "FAIL: client never completed a frame" << endl; return 1; }
+        if (phase == 1 && peer.mostParts < 2) { cout << "FAIL: full-state frames fit one datagram, chunking not exercised" << endl; return 1; }
     }
+    cout << "  " << net.snapshotsUndecodable << " undecodable, " << server.link.packetsDropped << " datagrams dropped by --net-loss" << endl;
+    if (mismatches) { cout << "FAIL: " << mismatches << " frames differ from what the server sent" << endl; return 1; }
+    cout << "OK" << endl;
+    return 0;
+}
 
-    void handleGameplayInput(const SDL_Event& event) {
-         if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
-            if (player1.isActive) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_w: player1.velocityY = -PLAYER_SPEED; player1.lastDirY = -1; player1.lastDirX = 0; break;
-                    case SDLK_s: player1.velocityY = PLAYER_SPEED; player1.lastDirY = 1; player1.lastDirX = 0; break;
-                    case SDLK_a: player1.velocityX = -PLAYER_SPEED; player1.lastDirX = -1; player1.lastDirY = 0; break;
-                    case SDLK_d: player1.velocityX = PLAYER_SPEED; player1.lastDirX = 1; player1.lastDirY = 0; break;
-                    case SDLK_j: if (player1.shoot() && bulletShotSound) Mix_PlayChannel(-1, bulletShotSound, 0); break;
-                }
-            }
-            if (numberOfPlayers == 2 && player2.isActive) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_UP:    player2.velocityY = -PLAYER_SPEED; player2.lastDirY = -1; player2.lastDirX = 0; break;
-                    case SDLK_DOWN:  player2.velocityY = PLAYER_SPEED; player2.lastDirY = 1; player2.lastDirX = 0; break;
-                    case SDLK_LEFT:  player2.velocityX = -PLAYER_SPEED; player2.lastDirX = -1; player2.lastDirY = 0; break;
-                    case SDLK_RIGHT: player2.velocityX = PLAYER_SPEED; player2.lastDirX = 1; player2.lastDirY = 0; break;
-                    case SDLK_RCTRL: case SDLK_LCTRL: if (player2.shoot() && bulletShotSound) Mix_PlayChannel(-1, bulletShotSound, 0); break;
-                }
-            }
-            if (event.key.keysym.sym == SDLK_ESCAPE) running = false;
+// =============================================================================
+// == Chạy Nhiều Trận Song Song Trong Một Tiến Trình (--host) ==
+// =============================================================================
+// Mỗi trận là một Game không giao diện riêng (mọi trạng thái mô phỏng, RNG, đồng hồ tick nằm trong
+// Game; bộ đệm bản đồ và logger dùng chung đều an toàn đa luồng). StealingScheduler chạy các trận
+// theo lát HOST_SLICE_TICKS tick trên các luồng, nên trăm trận cùng tiến lên thay vì lần lượt.
+// Kết quả mỗi trận chỉ phụ thuộc seed của nó, không phụ thuộc số luồng hay thứ tự chạy.
+const int HOST_SLICE_TICKS = 60;
+const int HOST_LATENCY_BUCKET_NS = 100;  // Độ phân giải histogram thời gian tick
+const int HOST_LATENCY_BUCKETS = 2000;   // Tới 200 µs; dài hơn dồn vào ô cuối
+
+struct HostOptions {
+    int matches = 0;
+    int threads = 0;     // 0 = số nhân
+    int players = 1;
+    int startLevel = 1;
+    Uint32 maxTicksPerMatch = 60 * TICKS_PER_SECOND * 10;
+    unsigned seed = 1;   // Trận i dùng seed + i
+    Uint32 mapSeed = 0;
+    const char* csvPath = nullptr;
+};
+
+struct HostedMatch {
+    std::unique_ptr<Game> game; // Tạo ở lát đầu, hủy khi trận xong
+    Uint32 ticks = 0;
+    Uint64 tickNsSum = 0;
+    Uint32 tickNsMax = 0;
+    int levelReached = 0;
+    bool won = false, over = false;
+};
+
+int runMatchHost(const HostOptions& opt) {
+    int workers = opt.threads > 0 ? opt.threads : max(1, (int)std::thread::hardware_concurrency());
+    vector<HostedMatch> matches(opt.matches);
+    vector<vector<Uint64>> latency(workers, vector<Uint64>(HOST_LATENCY_BUCKETS, 0)); // Histogram riêng từng luồng
+    StealingScheduler scheduler;
+    auto t0 = std::chrono::steady_clock::now();
+    scheduler.run(workers, opt.matches, [&](int worker, int id) {
+        HostedMatch& m = matches[id];
+        if (!m.game) {
+            m.game.reset(new Game(true));
+            m.game->fixedMapSeed = opt.mapSeed; m.game->rng.seed(opt.seed + (Uint64)id);
+            m.game->startMatch(opt.players, opt.startLevel);
         }
-        else if (event.type == SDL_KEYUP && event.key.repeat == 0) {
-            if (player1.isActive) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_w: if (player1.velocityY < 0) player1.velocityY = 0; break;
-                    case SDLK_s: if (player1.velocityY > 0) player1.velocityY = 0; break;
-                    case SDLK_a: if (player1.velocityX < 0) player1.velocityX = 0; break;
-                    case SDLK_d: if (player1.velocityX > 0) player1.velocityX = 0; break;
-                }
-                if (player1.velocityX == 0 && player1.velocityY != 0) { player1.lastDirX = 0; player1.lastDirY = (player1.velocityY > 0) ? 1 : -1; }
-                else if (player1.velocityY == 0 && player1.velocityX != 0) { player1.lastDirY = 0; player1.lastDirX = (player1.velocityX > 0) ? 1 : -1; }
-            }
-            if (numberOfPlayers == 2 && player2.isActive) {
-                 switch (event.key.keysym.sym) {
-                    case SDLK_UP:    if (player2.velocityY < 0) player2.velocityY = 0; break;
-                    case SDLK_DOWN:  if (player2.velocityY > 0) player2.velocityY = 0; break;
-                    case SDLK_LEFT:  if (player2.velocityX < 0) player2.velocityX = 0; break;
-                    case SDLK_RIGHT: if (player2.velocityX > 0) player2.velocityX = 0; break;
-                }
-                if (player2.velocityX == 0 && player2.velocityY != 0) { player2.lastDirX = 0; player2.lastDirY = (player2.velocityY > 0) ? 1 : -1; }
-                else if (player2.velocityY == 0 && player2.velocityX != 0) { player2.lastDirY = 0; player2.lastDirX = (player2.velocityX > 0) ? 1 : -1; }
+        Game& game = *m.game;
+        Uint64* histogram = latency[worker].data();
+        for (int t = 0; t < HOST_SLICE_TICKS && !game.matchOver && m.ticks < opt.maxTicksPerMatch; ++t) {
+            auto start = std::chrono::steady_clock::now();
+            game.update();
+            Uint32 ns = (Uint32)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            m.ticks++; m.tickNsSum += ns; m.tickNsMax = max(m.tickNsMax, ns);
+            histogram[min(ns / HOST_LATENCY_BUCKET_NS, (Uint32)HOST_LATENCY_BUCKETS - 1)]++;
+        }
+        if (!game.matchOver && m.ticks < opt.maxTicksPerMatch) return true;
+        m.levelReached = game.currentLevel; m.won = game.matchWon; m.over = game.matchOver;
+        m.game.reset();
+        return false;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    vector<Uint64> merged(HOST_LATENCY_BUCKETS, 0);
+    for (const auto& h : latency) for (int b = 0; b < HOST_LATENCY_BUCKETS; ++b) merged[b] += h[b];
+    long long totalTicks = 0; int wins = 0, losses = 0, timeouts = 0; Uint32 worstTick = 0;
+    vector<double> meanTickUs; meanTickUs.reserve(matches.size());
+    for (const auto& m : matches) {
+        totalTicks += m.ticks; worstTick = max(worstTick, m.tickNsMax);
+        if (m.won) wins++; else if (m.over) losses++; else timeouts++;
+        if (m.ticks) meanTickUs.push_back(m.tickNsSum / 1000.0 / m.ticks);
+    }
+    auto percentileUs = [&](double q) {
+        Uint64 target = (Uint64)(q * totalTicks), seen = 0;
+        for (int b = 0; b < HOST_LATENCY_BUCKETS; ++b) if ((seen += merged[b]) > target) return (b + 1) * HOST_LATENCY_BUCKET_NS / 1000.0;
+        return HOST_LATENCY_BUCKETS * HOST_LATENCY_BUCKET_NS / 1000.0;
+    };
+    std::sort(meanTickUs.begin(), meanTickUs.end());
+    cout << "Match host: " << opt.matches << " matches (" << opt.players << "P, start level " << opt.startLevel << ") on "
+         << workers << " threads, " << scheduler.steals << " steals\n"
+         << "  wins " << wins << ", losses " << losses << ", timeouts " << timeouts << "\n"
+         << "  total ticks " << totalTicks << " in " << seconds << " s, aggregate ticks/second: " << (seconds > 0 ? totalTicks / seconds : 0.0) << "\n"
+         << "  tick latency (us): p50 " << percentileUs(0.5) << ", p99 " << percentileUs(0.99) << ", p99.9 " << percentileUs(0.999)
+         << ", max " << worstTick / 1000.0 << "\n";
+    if (!meanTickUs.empty())
+        cout << "  per-match mean tick (us): best " << meanTickUs.front() << ", median " << meanTickUs[meanTickUs.size() / 2]
+             << ", worst " << meanTickUs.back() << "\n";
+    cout << flush;
+    if (opt.csvPath) {
+        std::ofstream out(opt.csvPath, std::ios::trunc);
+        if (!out) { cerr << "ERROR: Cannot write " << opt.csvPath << endl; return 1; }
+        out << "match,seed,result,level,ticks,mean_tick_us,max_tick_us\n";
+        for (int i = 0; i < opt.matches; ++i) {
+            const HostedMatch& m = matches[i];
+            out << i << ',' << opt.seed + (Uint64)i << ',' << (m.won ? "win" : m.over ? "loss" : "timeout") << ',' << m.levelReached << ','
+                << m.ticks << ',' << (m.ticks ? m.tickNsSum / 1000.0 / m.ticks : 0.0) << ',' << m.tickNsMax / 1000.0 << '\n';
+        }
+        cout << "  per-match results written to " << opt.csvPath << endl;
+    }
+    return 0;
+}
+
+// =============================================================================
+// == Môi Trường Huấn Luyện Nhiều Thế Giới (VecEnv) ==
+// =============================================================================
+// K trận không giao diện chạy đồng bộ từng bước cho việc huấn luyện bot. step() nhận K*players mặt nạ
+// INPUT_* (đi qua đúng đường đầu vào của máy chủ mạng), chạy frameSkip tick, rồi ghi vào bộ đệm của
+// người gọi: quan sát [K][OBS_CHANNELS][MAP_HEIGHT][MAP_WIDTH] (Uint8 0/1, ô theo tâm xe/đạn), phần
+// thưởng [K] và cờ kết thúc [K]. Thế giới kết thúc (thua, thắng, quá maxEpisodeTicks) được đặt lại
+// ngay với seed mới, và quan sát trả về là của ván mới. step() không cấp phát; các thế giới chia cho
+// WorkerPool nếu có luồng phụ, kết quả như nhau với mọi số luồng.
+enum ObsChannel {
+    OBS_BRICK, OBS_STEEL, OBS_WATER, OBS_BUSH, // Trùng thứ tự WallType
+    OBS_PLAYER1, OBS_PLAYER2, OBS_ENEMY, OBS_PLAYER_BULLET, OBS_ENEMY_BULLET,
+    OBS_CHANNELS
+};
+const int OBS_PLANE = MAP_HEIGHT * MAP_WIDTH;
+const int OBS_SIZE = OBS_CHANNELS * OBS_PLANE; // Byte quan sát của một thế giới
+
+const float REWARD_ENEMY_DESTROYED = 1.0f;
+const float REWARD_PLAYER_HIT = -1.0f;
+const float REWARD_LEVEL_CLEARED = 5.0f;
+
+class VecEnv {
+public:
+    int players = 1, startLevel = 1, frameSkip = 1;
+    Uint32 maxEpisodeTicks = 60 * TICKS_PER_SECOND * 10;
+    Uint64 episodesFinished = 0;
+
+    VecEnv(int count, int workerThreads = 0) : worlds(count) {
+        for (auto& w : worlds) {
+            w.game.reset(new Game(true));
+            w.game->autoPlayers = false; w.game->useNetworkInput = true;
+        }
+        if (workerThreads > 0) pool.reset(new WorkerPool(workerThreads));
+    }
+
+    int size() const { return (int)worlds.size(); }
+
+    // Thế giới i chơi các ván seed + i, seed + i + K, ... ; ghi quan sát đầu tiên vào observations
+    void reset(Uint64 seed, Uint8* observations) {
+        for (int i = 0; i < size(); ++i) { worlds[i].nextSeed = seed + (Uint64)i; worlds[i].seedStride = (Uint64)size(); }
+        auto body = [&](int i) { beginEpisode(worlds[i]); observe(*worlds[i].game, observations + (size_t)i * OBS_SIZE); };
+        forEachWorld(body);
+    }
+
+    // actions: [K][players] mặt nạ INPUT_*; observations: [K][OBS_SIZE]; rewards, dones: [K]
+    void step(const Uint8* actions, Uint8* observations, float* rewards, Uint8* dones) {
+        auto body = [&](int i) {
+            World& w = worlds[i]; Game& g = *w.game;
+            const Uint8* a = actions + (size_t)i * players;
+            g.networkInput = (Uint16)(a[0] | (players == 2 ? a[1] << 8 : 0));
+            int level = g.currentLevel; Uint32 destroyed = g.enemiesDestroyed, hits = g.playerHits;
+            for (int t = 0; t < frameSkip && !g.matchOver; ++t) g.update();
+            w.ticks += frameSkip;
+            float reward = REWARD_ENEMY_DESTROYED * (g.enemiesDestroyed - destroyed) + REWARD_PLAYER_HIT * (g.playerHits - hits);
+            if (g.currentLevel > level || g.matchWon) reward += REWARD_LEVEL_CLEARED;
+            bool done = g.matchOver || w.ticks >= maxEpisodeTicks;
+            rewards[i] = reward; dones[i] = done;
+            if (done) beginEpisode(w);
+            observe(g, observations + (size_t)i * OBS_SIZE);
+        };
+        forEachWorld(body);
+        for (int i = 0; i < size(); ++i) episodesFinished += dones[i];
+    }
+
+    Game& world(int i) { return *worlds[i].game; }
+
+    // Tensor chiếm chỗ của một thế giới: địa hình lấy thẳng từ bitboard (mỗi 8 bit -> 8 byte qua bảng),
+    // xe và đạn theo ô chứa tâm
+    static void observe(const Game& g, Uint8* out) {
+        static const struct ByteSpread { Uint64 v[256]; ByteSpread() { for (int b = 0; b < 256; ++b) { v[b] = 0; for (int k = 0; k < 8; ++k) if (b & (1 << k)) memset((Uint8*)&v[b] + k, 1, 1); } } } spread;
+        for (int type = 0; type < 4; ++type)
+            for (int r = 0; r < MAP_HEIGHT; ++r) {
+                Uint64 bits = g.terrain.rows[type][r]; Uint8* row = out + type * OBS_PLANE + r * MAP_WIDTH;
+                int c = 0;
+                for (; c + 8 <= MAP_WIDTH; c += 8) memcpy(row + c, &spread.v[(bits >> c) & 0xFF], 8);
+                if (c < MAP_WIDTH) memcpy(row + c, &spread.v[(bits >> c) & 0xFF], (size_t)(MAP_WIDTH - c));
             }
+        memset(out + OBS_PLAYER1 * OBS_PLANE, 0, (size_t)(OBS_CHANNELS - OBS_PLAYER1) * OBS_PLANE);
+        auto mark = [out](int channel, int px, int py) {
+            int c = px / TILE_SIZE, r = py / TILE_SIZE;
+            if (c >= 0 && c < MAP_WIDTH && r >= 0 && r < MAP_HEIGHT) out[channel * OBS_PLANE + r * MAP_WIDTH + c] = 1;
+        };
+        if (g.player1.isActive) mark(OBS_PLAYER1, g.player1.x + TILE_SIZE / 2, g.player1.y + TILE_SIZE / 2);
+        if (g.numberOfPlayers == 2 && g.player2.isActive) mark(OBS_PLAYER2, g.player2.x + TILE_SIZE / 2, g.player2.y + TILE_SIZE / 2);
+        for (const auto& e : g.enemies.hot) if (e.active) mark(OBS_ENEMY, e.rect.x + TILE_SIZE / 2, e.rect.y + TILE_SIZE / 2);
+        for (int i = 0; i < g.bullets.count; ++i) {
+            if (!g.bullets.alive[i]) continue;
+            SDL_Rect b = g.bullets.rect(i);
+            mark(g.bullets.owner[i] < OWNER_ENEMY_BASE ? OBS_PLAYER_BULLET : OBS_ENEMY_BULLET, b.x + b.w / 2, b.y + b.h / 2);
         }
-    } // End handleGameplayInput
+    }
 
-    void update() {
-         if (!running || currentState != GameState::PLAYING) return;
+private:
+    struct World { std::unique_ptr<Game> game; Uint64 nextSeed = 0, seedStride = 1; Uint32 ticks = 0; };
+    vector<World> worlds;
+    std::unique_ptr<WorkerPool> pool;
 
-         // Cập nhật Người Chơi
-         if (player1.isActive) { player1.updateCooldown(); player1.updatePosition(walls, enemies); player1.updateBullets(); }
-         if (numberOfPlayers == 2 && player2.isActive) { player2.updateCooldown(); player2.updatePosition(walls, enemies); player2.updateBullets(); }
-
-         // Cập nhật Kẻ Địch
-         for (auto& enemy : enemies) {
-             if (enemy.active) {
-                 enemy.updateHitStatus();
-                 // --- !!! GỌI HÀM AI MỚI !!! ---
-                 enemy.updateAIAndVelocity(player1, player2, numberOfPlayers, walls);
-                 // -----------------------------
-                 enemy.updatePosition(walls);
-                 enemy.updateBullets();
-             }
-         }
+    void beginEpisode(World& w) {
+        w.game->rng.seed(w.nextSeed); w.nextSeed += w.seedStride; w.ticks = 0;
+        w.game->startMatch(players, startLevel);
+    }
 
-         // Xử Lý Va Chạm Đạn Player 1
-         if (player1.isActive) {
-             for (auto& pB : player1.bullets) {
-                 if (!pB.active) continue; bool hit = false;
-                 for (auto& w : walls) if (w.active && w.type != WallType::BUSH && w.type != WallType::WATER && SDL_HasIntersection(&pB.rect, &w.rect)) { pB.active = false; if (w.type == WallType::BRICK) w.active = false; hit = true; break; }
-                 if (hit) continue;
-                 for (auto& e : enemies) if (e.active && SDL_HasIntersection(&pB.rect, &e.rect)) { pB.active = false; e.takeHit(); hit = true; break; }
-             }
-         }
-         // Xử Lý Va Chạm Đạn Player 2
-         if (numberOfPlayers == 2 && player2.isActive) {
-              for (auto& pB : player2.bullets) {
-                 if (!pB.active) continue; bool hit = false;
-                 for (auto& w : walls) if (w.active && w.type != WallType::BUSH && w.type != WallType::WATER && SDL_HasIntersection(&pB.rect, &w.rect)) { pB.active = false; if (w.type == WallType::BRICK) w.active = false; hit = true; break; }
-                 if (hit) continue;
-                 for (auto& e : enemies) if (e.active && SDL_HasIntersection(&pB.rect, &e.rect)) { pB.active = false; e.takeHit(); hit = true; break; }
-             }
-         }
-         // Xử Lý Va Chạm Đạn Địch
-         for (auto& e : enemies) {
-             if (!e.active) continue;
-             for (auto& eB : e.bullets) {
-                 if (!eB.active) continue; bool hitWall = false;
-                 for (auto& w : walls) if (w.active && w.type != WallType::BUSH && w.type != WallType::WATER && SDL_HasIntersection(&eB.rect, &w.rect)) { eB.active = false; if (w.type == WallType::BRICK) w.active = false; hitWall = true; break; }
-                 if (hitWall) continue;
-                 if (player1.isActive && SDL_HasIntersection(&eB.rect, &player1.rect)) { eB.active = false; player1.hitByEnemy(); if (playerDestroySound) Mix_PlayChannel(-1, playerDestroySound, 0); }
-                 else if (numberOfPlayers == 2 && player2.isActive && SDL_HasIntersection(&eB.rect, &player2.rect)) { eB.active = false; player2.hitByEnemy(); if (playerDestroySound) Mix_PlayChannel(-1, playerDestroySound, 0); }
-             }
-         }
+    template <class F> void forEachWorld(F& body) {
+        if (pool) pool->run(size(), body); else for (int i = 0; i < size(); ++i) body(i);
+    }
+};
 
-         // Dọn Dẹp Địch và Tạo Mới
-         enemies.erase(remove_if(enemies.begin(), enemies.end(), [](const EnemyTank &e){ return !e.active; }), enemies.end());
-         enemiesOnScreen = enemies.size();
-         if (enemiesToSpawn > 0 && enemiesOnScreen < maxEnemiesOnScreen) {
-             static Uint32 lastSpawnTime = 0; const Uint32 SPAWN_DELAY = 2000;
-             Uint32 currentTime = SDL_GetTicks();
-             if (currentTime > lastSpawnTime + SPAWN_DELAY) {
-                 if (trySpawnOneEnemy()) lastSpawnTime = currentTime; else lastSpawnTime = currentTime - SPAWN_DELAY / 2;
-             }
-         }
+struct EnvBenchOptions {
+    int worlds = 0;
+    int steps = 10000;
+    int threads = 0;
+    int players = 1;
+    int frameSkip = 4;
+    unsigned seed = 1;
+};
 
-         // Kiểm Tra Thua Game
-         bool player1_is_out = !player1.isActive;
-         bool player2_is_out = (numberOfPlayers == 1) || (numberOfPlayers == 2 && !player2.isActive);
-         if (player1_is_out && player2_is_out) {
-             cout << "All players out! Game Over at Level " << currentLevel << ".\n";
-             if (gameOverSound) Mix_PlayChannel(-1, gameOverSound, 0);
-             currentState = GameState::GAME_OVER; return;
-         }
+// Đo số bước môi trường mỗi giây với hành động ngẫu nhiên (giữ hướng vài bước, thỉnh thoảng bắn)
+int runEnvBenchmark(const EnvBenchOptions& opt) {
+    VecEnv env(opt.worlds, opt.threads);
+    env.players = opt.players; env.frameSkip = max(1, opt.frameSkip);
+    vector<Uint8> observations((size_t)opt.worlds * OBS_SIZE), actions((size_t)opt.worlds * opt.players), dones(opt.worlds);
+    vector<float> rewards(opt.worlds);
+    SimRng rng; rng.seed(opt.seed);
+    env.reset(opt.seed, observations.data());
+    double rewardSum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int s = 0; s < opt.steps; ++s) {
+        for (auto& a : actions) if (rng.below(8) == 0) a = (Uint8)(((1 << rng.below(5)) & INPUT_DIRECTIONS) | (rng.below(3) == 0 ? INPUT_FIRE : 0));
+        env.step(actions.data(), observations.data(), rewards.data(), dones.data());
+        for (float r : rewards) rewardSum += r;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    long long envSteps = (long long)opt.steps * opt.worlds;
+    int cores = opt.threads + 1;
+    cout << "VecEnv: " << opt.worlds << " worlds x " << opt.steps << " steps (" << opt.players << "P, frame skip " << env.frameSkip
+         << ", " << cores << " thread(s)), observation " << OBS_SIZE << " bytes/world\n"
+         << "  " << envSteps << " env steps in " << seconds << " s: " << (seconds > 0 ? envSteps / seconds : 0.0) << " steps/s, "
+         << (seconds > 0 ? envSteps / seconds / cores : 0.0) << " steps/s per core\n"
+         << "  episodes finished " << env.episodesFinished << ", mean reward per step " << (envSteps ? rewardSum / envSteps : 0.0) << endl;
+    return 0;
+}
 
-         // Kiểm Tra Thắng Màn
-         if (currentLevel > 0 && enemiesToSpawn == 0 && enemies.empty()) {
-             cout << "\n===============================\n LEVEL " << currentLevel << " CLEARED! \n===============================\n\n";
-             if (levelUpSound) Mix_PlayChannel(-1, levelUpSound, 0);
-             SDL_Delay(1000);
-             if (currentLevel < maxLevels) {
-                 cout << "Proceeding to next level..." << endl; SDL_Delay(1500); setupLevel(currentLevel + 1);
-             } else {
-                 cout << "*******************************\n* CONGRATULATIONS! YOU WIN! *\n*******************************\n";
-                 SDL_Delay(3000); running = false;
-             }
-         }
-    } // End update()
+// =============================================================================
+// == Sinh Bản Đồ Hàng Loạt (--gen-maps) ==
+// =============================================================================
+// Sinh và kiểm tra count bản đồ (seed firstSeed.. firstSeed+count-1) cho một màn hoặc cả năm màn,
+// trên mọi lõi, không qua bộ đệm. Ghi CSV level,seed,carved_walls,open_tiles để chọn lọc bộ bản đồ:
+// seed có carved_walls = 0 là bản đồ sinh ra đã liên thông, open_tiles cho biết độ thoáng.
+struct MapGenOptions {
+    int count = 0;
+    int level = 0;       // 0 = màn 1..5
+    Uint32 firstSeed = 1;
+    const char* csvPath = nullptr;
+};
 
-    void render() {
-        if (!renderer) return;
-        switch (currentState) {
-            case GameState::SELECT_MODE: {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderClear(renderer);
-                if (menuTexture) SDL_RenderCopy(renderer, menuTexture, NULL, NULL);
-                else cerr << "Error: Menu texture is missing." << endl;
-                break;
+int runMapGeneration(const MapGenOptions& opt) {
+    const int firstLevel = opt.level ? opt.level : 1, lastLevel = opt.level ? opt.level : 5;
+    const int levels = lastLevel - firstLevel + 1, total = opt.count * levels;
+    vector<GeneratedMap> results(total);
+    auto t0 = std::chrono::steady_clock::now();
+    parallelFor(total, [&](int i) {
+        results[i] = generateLevelMap(firstLevel + i / opt.count, opt.firstSeed + (Uint32)(i % opt.count));
+        results[i].walls = vector<Wall>(); // Chỉ giữ thống kê
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    int repaired = 0, maxCarved = 0; long long carvedSum = 0, openSum = 0;
+    for (const auto& m : results) {
+        if (m.carvedWalls > 0) repaired++;
+        carvedSum += m.carvedWalls; maxCarved = max(maxCarved, m.carvedWalls); openSum += m.openTiles;
+    }
+    cout << "Map generation: " << total << " maps (levels " << firstLevel << "-" << lastLevel << ", seeds " << opt.firstSeed
+         << ".." << opt.firstSeed + (Uint32)(opt.count - 1) << ")\n"
+         << "  valid as generated " << (total - repaired) << ", repaired " << repaired
+         << " (avg " << (repaired ? (double)carvedSum / repaired : 0.0) << " walls removed, max " << maxCarved << ")\n"
+         << "  avg open tiles " << (total ? (double)openSum / total : 0.0) << "\n"
+         << "  " << seconds << " s, maps/second: " << (seconds > 0 ? total / seconds : 0.0) << endl;
+    if (opt.csvPath) {
+        std::ofstream out(opt.csvPath, std::ios::trunc);
+        if (!out) { cerr << "ERROR: Cannot write " << opt.csvPath << endl; return 1; }
+        out << "level,seed,carved_walls,open_tiles\n";
+        for (const auto& m : results) out << m.level << ',' << m.seed << ',' << m.carvedWalls << ',' << m.openTiles << '\n';
+        cout << "  per-map results written to " << opt.csvPath << endl;
+    }
+    return 0;
+}
+
+
+#if defined(BATTLECITY_BENCHMARKS)
+// =============================================================================
+// == Bộ Đo Hiệu Năng (make bench) ==
+// =============================================================================
+// Chỉ biên dịch vào target battlecity_bench (-DBATTLECITY_BENCHMARKS), bản game không bị ảnh hưởng.
+// Mọi cảnh đo dựng từ seed cố định. Mỗi phép đo tự tăng số op tới khi một vòng đủ dài, rồi báo
+// ns/op (trung vị của BENCH_ROUNDS vòng) và số lần cấp phát/op đếm qua operator new thay thế.
+static std::atomic<Uint64> benchAllocCount{0};
+void* operator new(std::size_t size) {
+    benchAllocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // Báo nhầm: cặp new/delete thay thế ở đây đều dùng malloc/free
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+const unsigned BENCH_SEED = 12345;
+const int BENCH_ROUNDS = 5;
+const double BENCH_MIN_ROUND_SECONDS = 0.05;
+const int BENCH_WARMUP_TICKS = 300;
+static volatile long long benchSink = 0; // Giữ kết quả để trình biên dịch không bỏ vòng lặp
+
+// body(n) thực hiện n op
+template <class Body> void runBenchmark(const char* name, const char* filter, Body body) {
+    if (filter && !strstr(name, filter)) return;
+    long long ops = 1;
+    for (;;) {
+        auto t0 = std::chrono::steady_clock::now(); body(ops);
+        if (std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() >= BENCH_MIN_ROUND_SECONDS || ops >= (1LL << 30)) break;
+        ops *= 2;
+    }
+    vector<double> nsPerOp; Uint64 allocs = 0;
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        Uint64 allocsBefore = benchAllocCount.load();
+        auto t0 = std::chrono::steady_clock::now(); body(ops);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        allocs += benchAllocCount.load() - allocsBefore; // Đọc trước push_back để không đếm cả lần nới vector của chính bộ đo
+        nsPerOp.push_back(ns / ops);
+    }
+    sort(nsPerOp.begin(), nsPerOp.end());
+    printf("%-44s %12.1f ns/op %10.3f allocs/op %12lld ops\n", name, nsPerOp[BENCH_ROUNDS / 2], (double)allocs / ((double)ops * BENCH_ROUNDS), ops);
+}
+
+// Cảnh chung: màn 3, hai người chơi do bot điều khiển, chạy BENCH_WARMUP_TICKS tick cho có địch và đạn
+std::unique_ptr<Game> makeBenchScene() {
+    std::unique_ptr<Game> game(new Game(true));
+    game->rng.seed(BENCH_SEED);
+    game->startMatch(2, 3);
+    for (int t = 0; t < BENCH_WARMUP_TICKS && !game->matchOver; ++t) game->update();
+    game->rebuildEnemyGrid();
+    return game;
+}
+
+int runBenchmarks(const char* filter) {
+    // Cảnh đo dựng qua Game: tắt [INFO] (dựng màn, nạp media) để bảng kết quả không bị chen ngang
+    std::atomic<int>& logLevel = AsyncLogger::instance().minLevel;
+    if (logLevel < (int)LogLevel::WARN) logLevel = (int)LogLevel::WARN;
+    printf("%-44s %18s %20s %16s\n", "benchmark", "time", "allocations", "iterations");
+
+    {
+        std::unique_ptr<Game> game = makeBenchScene();
+        if (game->enemies.empty()) cerr << "EnemyStore::isMoveValid: skipped, no enemies in scene" << endl;
+        else runBenchmark("EnemyStore::isMoveValid", filter, [&](long long n) {
+            const EnemyStore& es = game->enemies; long long valid = 0;
+            for (long long i = 0; i < n; ++i) {
+                int k = (int)(i % es.size()); const EnemyHot& e = es.hot[k]; int d = (int)(i / es.size()) & 3;
+                valid += es.isMoveValid(k, e.x + FLOW_DX[d] * 2, e.y + FLOW_DY[d] * 2, game->terrain, game->enemyRects, game->enemyGrid);
             }
-            case GameState::PLAYING: {
-                SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255); SDL_RenderClear(renderer);
-                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-                SDL_Rect playableArea = {TILE_SIZE, TILE_SIZE, SCREEN_WIDTH - 2 * TILE_SIZE, SCREEN_HEIGHT - 2 * TILE_SIZE}; SDL_RenderFillRect(renderer, &playableArea);
+            benchSink = benchSink + valid;
+        });
 
-                // Vẽ tường (trừ bụi cỏ)
-                for (auto &wall : walls) {
-                    if (!wall.active || wall.type == WallType::BUSH) continue; SDL_Texture* tex = nullptr;
-                    switch (wall.type) { case WallType::BRICK: tex = brickTexture; break; case WallType::STEEL: tex = steelTexture; break; case WallType::WATER: tex = waterTexture; break; default: break; }
-                    if (tex) SDL_RenderCopy(renderer, tex, nullptr, &wall.rect);
-                }
-                // Vẽ Địch
-                for (auto &enemy : enemies) {
-                    if (!enemy.active) continue; SDL_Texture* tex = nullptr;
-                    if (enemy.initialHitPoints > 1) { // Tank 3
-                        if (enemy.lastDirY < 0) tex = enemyTank3UpTexture; else if (enemy.lastDirY > 0) tex = enemyTank3DownTexture; else if (enemy.lastDirX < 0) tex = enemyTank3LeftTexture; else if (enemy.lastDirX > 0) tex = enemyTank3RightTexture; else tex = enemyTank3DownTexture;
-                    } else { // Tank 2
-                        if (enemy.lastDirY < 0) tex = enemyTank2UpTexture; else if (enemy.lastDirY > 0) tex = enemyTank2DownTexture; else if (enemy.lastDirX < 0) tex = enemyTank2LeftTexture; else if (enemy.lastDirX > 0) tex = enemyTank2RightTexture; else tex = enemyTank2DownTexture;
-                    }
-                    if (tex) {
-                        if (enemy.isHit) { SDL_SetTextureColorMod(tex, 255, 100, 100); SDL_SetTextureAlphaMod(tex, 200); } else { SDL_SetTextureColorMod(tex, 255, 255, 255); SDL_SetTextureAlphaMod(tex, 255); }
-                        SDL_RenderCopy(renderer, tex, nullptr, &enemy.rect);
-                        SDL_SetTextureColorMod(tex, 255, 255, 255); SDL_SetTextureAlphaMod(tex, 255); // Reset
-                    }
-                }
-                // Vẽ Player 1
-                if (player1.isActive) {
-                     SDL_Texture* p1Tex = nullptr;
-                     if (player1.lastDirY < 0) p1Tex = player1TankUpTexture; else if (player1.lastDirY > 0) p1Tex = player1TankDownTexture; else if (player1.lastDirX < 0) p1Tex = player1TankLeftTexture; else if (player1.lastDirX > 0) p1Tex = player1TankRightTexture; else p1Tex = player1TankUpTexture;
-                     if (p1Tex) SDL_RenderCopy(renderer, p1Tex, nullptr, &player1.rect);
-                     if (bulletTexture) for (auto &b : player1.bullets) if (b.active) SDL_RenderCopy(renderer, bulletTexture, nullptr, &b.rect);
-                }
-                // Vẽ Player 2
-                if (numberOfPlayers == 2 && player2.isActive) {
-                    SDL_Texture* p2Tex = nullptr;
-                    if (player2.lastDirY < 0) p2Tex = player2TankUpTexture; else if (player2.lastDirY > 0) p2Tex = player2TankDownTexture; else if (player2.lastDirX < 0) p2Tex = player2TankLeftTexture; else if (player2.lastDirX > 0) p2Tex = player2TankRightTexture; else p2Tex = player2TankUpTexture;
-                    if (p2Tex) SDL_RenderCopy(renderer, p2Tex, nullptr, &player2.rect);
-                    if (bulletTexture) for (auto &b : player2.bullets) if (b.active) SDL_RenderCopy(renderer, bulletTexture, nullptr, &b.rect);
-                }
-                 // Vẽ Đạn Địch
-                 if (bulletTexture) {
-                     for (auto &enemy : enemies) if(enemy.active) for (auto &b : enemy.bullets) if (b.active) SDL_RenderCopy(renderer, bulletTexture, nullptr, &b.rect);
-                 }
-                // Vẽ Bụi Cỏ (Sau cùng)
-                for (auto &wall : walls) if (wall.active && wall.type == WallType::BUSH && grassTexture) SDL_RenderCopy(renderer, grassTexture, nullptr, &wall.rect);
-                break;
+        // Sinh/hạ xen kẽ trên kho 64 xe: đo swap-and-pop + tái dùng slot, không phải dời mảng
+        runBenchmark("EnemyStore spawn + removeInactive (64)", filter, [&](long long n) {
+            EnemyStore es; es.reserve(64); long long live = 0;
+            for (int k = 0; k < 64; ++k) es.spawn(TILE_SIZE * (1 + k % 28), TILE_SIZE * (1 + k / 28), 1, (Uint32)k);
+            for (long long i = 0; i < n; ++i) {
+                es.hot[(int)(i * 37 % es.size())].active = false;
+                es.removeInactive();
+                es.spawn(TILE_SIZE, TILE_SIZE, 1, (Uint32)i);
+                live += es.size();
             }
-            case GameState::GAME_OVER: {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); SDL_RenderClear(renderer);
-                if (gameOverTexture) {
-                    int imgW, imgH; SDL_QueryTexture(gameOverTexture, NULL, NULL, &imgW, &imgH);
-                    SDL_Rect dstRect = {(SCREEN_WIDTH - imgW) / 2, (SCREEN_HEIGHT - imgH) / 2, imgW, imgH }; SDL_RenderCopy(renderer, gameOverTexture, NULL, &dstRect);
-                } else cerr << "Warning: Game Over texture missing." << endl;
-                break;
+            benchSink = benchSink + live;
+        });
+
+        runBenchmark("PlayerTank::updatePosition", filter, [&](long long n) {
+            PlayerTank p = game->player1; int startX = p.x, startY = p.y; long long moved = 0;
+            for (long long i = 0; i < n; ++i) {
+                if (i % 256 == 0) p.reset(startX, startY);
+                if (i % 16 == 0) { int d = (int)(i / 16) & 3; p.velocityX = FLOW_DX[d] * PLAYER_SPEED_FP; p.velocityY = FLOW_DY[d] * PLAYER_SPEED_FP; }
+                p.updatePosition(game->terrain, game->enemies, game->enemyGrid);
+                moved += p.x;
+            }
+            benchSink = benchSink + moved;
+        });
+    }
+
+    // Pha AI trên N xe đặt ở các ô trống: mỗi op là một xe nghĩ một tick, để thấy chi phí mỗi xe không tăng theo N
+    for (int count : {8, 32, 64}) {
+        std::unique_ptr<Game> game = makeBenchScene();
+        Game& g = *game; g.enemies.clear();
+        for (int r = 1; r < MAP_HEIGHT - 1 && g.enemies.size() < count; r += 2)
+            for (int c = 1; c < MAP_WIDTH - 1 && g.enemies.size() < count; c += 2) {
+                SDL_Rect tile = {c * TILE_SIZE, r * TILE_SIZE, TILE_SIZE, TILE_SIZE};
+                if (g.terrain.tankBlockingRow(r) >> c & 1) continue;
+                if (SDL_HasIntersection(&tile, &g.player1.rect) || SDL_HasIntersection(&tile, &g.player2.rect)) continue;
+                g.enemies.spawn(tile.x, tile.y, 3, BENCH_SEED + (Uint32)g.enemies.size());
+            }
+        g.rebuildEnemyGrid();
+        char name[64]; snprintf(name, sizeof(name), "EnemyStore::updateAIAndVelocity (%d enemies)", g.enemies.size());
+        runBenchmark(name, filter, [&](long long n) {
+            for (long long i = 0; i < n; ++i)
+                g.enemies.updateAIAndVelocity((int)(i % g.enemies.size()), g.player1, g.player2, g.numberOfPlayers, g.terrain, g.sight, g.enemyRects, g.enemyGrid, g.playerFlow);
+            benchSink = benchSink + g.enemies.hot[0].velocityX;
+        });
+    }
+
+    {   // 64 viên đạn của cả hai người chơi và địch, đặt trên các ô trống không chạm xe tăng nên không viên nào chết:
+        // mỗi op là một lượt va chạm đầy đủ (quét lưới ô, địch, người chơi) mà trạng thái không đổi
+        std::unique_ptr<Game> game = makeBenchScene();
+        Game& g = *game; g.bullets.clear();
+        const int BENCH_BULLETS = 64;
+        for (int r = 1; r < MAP_HEIGHT - 1 && g.bullets.count < BENCH_BULLETS; ++r)
+            for (int c = 1; c < MAP_WIDTH - 1 && g.bullets.count < BENCH_BULLETS; c += 2) {
+                SDL_Rect tile = {c * TILE_SIZE, r * TILE_SIZE, TILE_SIZE, TILE_SIZE};
+                if (g.terrain.tankBlockingRow(r) >> c & 1) continue;
+                if (g.enemyGrid.firstMatch(tile, [&](int id) { return SDL_HasIntersection(&tile, &g.enemyRects[id]); }) >= 0) continue;
+                if (SDL_HasIntersection(&tile, &g.player1.rect) || SDL_HasIntersection(&tile, &g.player2.rect)) continue;
+                int k = g.bullets.count % 3;
+                int owner = (k == 0) ? OWNER_PLAYER1 : (k == 1) ? OWNER_PLAYER2 : OWNER_ENEMY_BASE + (g.enemies.empty() ? 0 : g.enemies.cold[0].id);
+                g.bullets.spawn(tile.x + TILE_SIZE / 2.0f, tile.y + TILE_SIZE / 2.0f, 0, -1, owner);
+                g.bullets.prevFy[g.bullets.count - 1] += BULLET_SPEED_FP; // Đoạn quét một tick, vẫn trong cùng ô
+            }
+        char name[64]; snprintf(name, sizeof(name), "Game::resolveBulletCollisions (%d bullets)", g.bullets.count);
+        runBenchmark(name, filter, [&](long long n) { for (long long i = 0; i < n; ++i) g.resolveBulletCollisions(); benchSink = benchSink + g.bullets.count; });
+    }
+
+    {
+        vector<Wall> walls;
+        runBenchmark("generateWalls (levels 1-5)", filter, [&](long long n) {
+            LevelRng rng(BENCH_SEED);
+            for (long long i = 0; i < n; ++i) { generateWalls(1 + (int)(i % 5), rng, walls); benchSink = benchSink + (long long)walls.size(); }
+        });
+        runBenchmark("generateLevelMap (levels 1-5, validated)", filter, [&](long long n) {
+            for (long long i = 0; i < n; ++i) benchSink = benchSink + generateLevelMap(1 + (int)(i % 5), BENCH_SEED + (Uint32)i).openTiles;
+        });
+    }
+
+    {
+        std::unique_ptr<Game> game = makeBenchScene();
+        std::unique_ptr<WorldSnapshot> base(new WorldSnapshot), next(new WorldSnapshot);
+        vector<Uint8> delta; delta.reserve(sizeof(WorldSnapshot));
+        game->captureSnapshot(*base);
+        runBenchmark("Game::captureSnapshot", filter, [&](long long n) { for (long long i = 0; i < n; ++i) benchSink = benchSink + game->captureSnapshot(*next); });
+        runBenchmark("Game::restoreSnapshot", filter, [&](long long n) { for (long long i = 0; i < n; ++i) game->restoreSnapshot(*base); benchSink = benchSink + game->enemies.size(); });
+        game->update(); game->captureSnapshot(*next);
+        runBenchmark("encodeSnapshotDelta (one tick apart)", filter, [&](long long n) {
+            for (long long i = 0; i < n; ++i) { encodeSnapshotDelta(*base, *next, delta); benchSink = benchSink + delta.size(); }
+        });
+    }
+
+    {
+        const int WORLDS = 64;
+        VecEnv env(WORLDS); env.frameSkip = 4;
+        vector<Uint8> observations((size_t)WORLDS * OBS_SIZE), actions(WORLDS, INPUT_UP | INPUT_FIRE), dones(WORLDS);
+        vector<float> rewards(WORLDS);
+        env.reset(BENCH_SEED, observations.data());
+        runBenchmark("VecEnv::step (64 worlds, frame skip 4)", filter, [&](long long n) {
+            for (long long i = 0; i < n; ++i) { env.step(actions.data(), observations.data(), rewards.data(), dones.data()); benchSink = benchSink + dones[0]; }
+        });
+    }
+
+    {
+        std::unique_ptr<Game> game = makeBenchScene();
+        runBenchmark("Game::trySpawnOneEnemy", filter, [&](long long n) {
+            game->rng.seed(BENCH_SEED);
+            for (long long i = 0; i < n; ++i) {
+                game->enemies.clear(); game->enemiesOnScreen = 0; game->enemiesToSpawn = 1;
+                benchSink = benchSink + game->trySpawnOneEnemy();
             }
+        });
+    }
+
+    const char* RENDER_BENCH = "Game::render (software, dummy video)";
+    if (!filter || strstr(RENDER_BENCH, filter)) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 0); SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+        SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+        Game game(false, false);
+        if (!game.running) cerr << RENDER_BENCH << ": skipped, SDL initialization failed" << endl;
+        else {
+            game.rng.seed(BENCH_SEED); game.startMatch(2, 3);
+            for (int t = 0; t < BENCH_WARMUP_TICKS && !game.matchOver; ++t) game.update();
+            runBenchmark(RENDER_BENCH, filter, [&](long long n) { for (long long i = 0; i < n; ++i) game.render(0.5f); });
         }
-        SDL_RenderPresent(renderer);
-    } // End render()
+    }
+    return 0;
+}
 
-    void run() {
-        const int TARGET_FPS = 60; const int FRAME_DELAY = 1000 / TARGET_FPS;
-        Uint32 frameStart; int frameTime;
-        cout << "Starting Game Loop..." << endl;
-        while (running) {
-            frameStart = SDL_GetTicks();
-            handleEvents();
-            update();
-            render();
-            frameTime = SDL_GetTicks() - frameStart;
-            if (FRAME_DELAY > frameTime) SDL_Delay(FRAME_DELAY - frameTime);
-        }
-        cout << "Exiting Game Loop." << endl;
-    } // End run()
+// Chốt chặn "tick ổn định không cấp phát" (--alloc-guard): chạy trận bot hai người chơi, bỏ qua
+// BENCH_WARMUP_TICKS tick đầu mỗi màn (dựng màn, các kho còn đang lớn tới dung lượng làm việc), sau đó
+// mọi tick update() ở giữa màn phải có 0 lần cấp phát. Trả 1 (để CI đánh trượt) nếu có tick vi phạm.
+int runAllocGuard(Uint32 ticks) {
+    Uint32 measured = 0, failing = 0, firstFailTick = 0; Uint64 allocs = 0, worst = 0; unsigned matches = 0;
+    while (measured < ticks) {
+        std::unique_ptr<Game> game(new Game(true));
+        game->rng.seed(BENCH_SEED + matches++);
+        game->startMatch(2, 1);
+        int level = game->currentLevel; Uint32 levelStartTick = game->tick;
+        while (!game->matchOver && measured < ticks) {
+            Uint64 before = benchAllocCount.load();
+            game->update();
+            Uint64 n = benchAllocCount.load() - before;
+            if (game->currentLevel != level) { level = game->currentLevel; levelStartTick = game->tick; continue; } // Tick dựng màn
+            if (game->matchOver || game->tick - levelStartTick <= (Uint32)BENCH_WARMUP_TICKS) continue;
+            measured++;
+            if (n == 0) continue;
+            if (failing++ == 0) firstFailTick = game->tick;
+            allocs += n; worst = max(worst, n);
+        }
+    }
+    printf("alloc guard: %u steady-state ticks over %u matches, %u ticks allocated (%llu allocations, worst %llu in one tick)\n",
+           measured, matches, failing, (unsigned long long)allocs, (unsigned long long)worst);
+    if (failing) { printf("FAIL: first allocating tick %u (seed %u)\n", firstFailTick, BENCH_SEED + matches - 1); return 1; }
+    printf("OK\n");
+    return 0;
+}
+#endif
 
-}; // End class Game
+// =============================================================================
+// == Đóng Gói Tài Nguyên (--pack-assets) ==
+// =============================================================================
+int packAssetBundle(const char* path) {
+    int imgFlags = IMG_INIT_PNG | IMG_INIT_JPG;
+    if (!(IMG_Init(imgFlags) & imgFlags)) { cerr << "SDL_image Error: " << IMG_GetError() << endl; return 1; }
+    vector<BundleEntry> entries; vector<vector<Uint8>> payloads;
+    auto addEntry = [&](const char* name, BundleKind kind, Uint32 a, Uint32 b, Uint32 c, vector<Uint8> bytes) {
+        BundleEntry e; memset(&e, 0, sizeof(e));
+        strncpy(e.name, name, sizeof(e.name) - 1);
+        e.kind = kind; e.a = a; e.b = b; e.c = c; e.size = bytes.size();
+        entries.push_back(e); payloads.push_back(std::move(bytes));
+    };
+    auto addImage = [&](const char* name, SDL_Surface* surface) { // Chép từng hàng: pitch trong gói = w * 4
+        Uint32 pitch = (Uint32)surface->w * 4;
+        vector<Uint8> pixels((size_t)pitch * surface->h);
+        for (int y = 0; y < surface->h; ++y) memcpy(&pixels[(size_t)y * pitch], (const Uint8*)surface->pixels + (size_t)y * surface->pitch, pitch);
+        addEntry(name, BundleKind::IMAGE, (Uint32)surface->w, (Uint32)surface->h, pitch, std::move(pixels));
+    };
+
+    SpriteAtlas atlas; bool essentialOk = true;
+    SDL_Surface* packed = atlas.packFromFiles(essentialOk);
+    if (!packed || !essentialOk) { cerr << "ERROR: Missing sprite images, bundle not written." << endl; if (packed) SDL_FreeSurface(packed); IMG_Quit(); return 1; }
+    addImage("@atlas", packed); SDL_FreeSurface(packed);
+    vector<Uint8> layout(sizeof(atlas.regions));
+    memcpy(layout.data(), atlas.regions, sizeof(atlas.regions));
+    addEntry("@atlas_regions", BundleKind::BLOB, 0, 0, 0, std::move(layout));
+
+    static const char* const IMAGE_FILES[] = {"giao_dien.jpg", "game_over.png"};
+    static const char* const SOUND_FILES[] = {"bullet_shot.wav", "broken.wav", "level_up.wav"}; // game_over.wav phát dạng stream từ file
+    SDL_Surface* screens[2] = {};
+    vector<vector<Uint8>> pcm(3); vector<char> pcmOk(3, 0);
+    parallelFor(5, [&](int i) {
+        if (i < 2) screens[i] = decodeImageFile(IMAGE_FILES[i]);
+        else pcmOk[i - 2] = decodeWavFile(SOUND_FILES[i - 2], AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, AUDIO_CHANNELS, pcm[i - 2]);
+    });
+    for (int i = 0; i < 2; ++i) {
+        if (!screens[i]) { cerr << "Warning: Failed to load " << IMAGE_FILES[i] << ", skipped." << endl; continue; }
+        addImage(IMAGE_FILES[i], screens[i]); SDL_FreeSurface(screens[i]);
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (!pcmOk[i]) { cerr << "Warning: Failed to load " << SOUND_FILES[i] << ", skipped." << endl; continue; }
+        addEntry(SOUND_FILES[i], BundleKind::PCM, AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, AUDIO_CHANNELS, std::move(pcm[i]));
+    }
+    IMG_Quit();
+
+    const Uint64 ALIGN = 64;
+    Uint64 offset = sizeof(BundleHeader) + entries.size() * sizeof(BundleEntry);
+    for (BundleEntry& e : entries) { offset = (offset + ALIGN - 1) & ~(ALIGN - 1); e.offset = offset; offset += e.size; }
 
+    BundleHeader header; memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION; header.entryCount = (Uint32)entries.size();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) { cerr << "ERROR: Cannot write " << path << endl; return 1; }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)entries.data(), (std::streamsize)(entries.size() * sizeof(BundleEntry)));
+    for (size_t i = 0; i < entries.size(); ++i) {
+        static const char zeros[64] = {};
+        out.write(zeros, (std::streamsize)(entries[i].offset - (Uint64)out.tellp()));
+        out.write((const char*)payloads[i].data(), (std::streamsize)payloads[i].size());
+    }
+    if (!out) { cerr << "ERROR: Failed while writing " << path << endl; return 1; }
+    cout << "Wrote " << path << ": " << entries.size() << " entries, " << offset << " bytes." << endl;
+    return 0;
+}
 
 // =============================================================================
 // == Hàm main ==
 // =============================================================================
 int main(int argc, char* argv[]) {
+    // battlecity [--no-vsync] [--ai-threads N] [--map-seed S] [--seed S] [--record FILE]
+    // battlecity --replay FILE [--trace FILE] [--log-level debug|info|warn|error|off]
+    // battlecity --headless [--matches N] [--players 1|2] [--level L] [--max-ticks T] [--seed S] [--map-seed S] [--ai-threads N] [--trace FILE]
+    // battlecity --server [--port P] [--players 1|2] [--level L] [--seed S] [--map-seed S] [--net-latency MS] [--net-jitter MS] [--net-loss PCT]
+    // battlecity --connect HOST[:PORT] [--headless] [--seconds N] [--seed S] [--net-latency MS] [--net-jitter MS] [--net-loss PCT]
+    // battlecity --net-selftest [level] [--net-loss PCT]   (máy chủ + client qua loopback, mặc định màn 20; thoát 1 nếu client không đồng bộ)
+    // battlecity --host N [--host-threads T] [--players 1|2] [--level L] [--max-ticks T] [--seed S] [--map-seed S] [--host-out FILE.csv]
+    // battlecity --env-bench K [--env-steps N] [--frame-skip F] [--ai-threads T] [--players 1|2] [--seed S]
+    // battlecity --pack-assets [bundle_path]
+    // battlecity --gen-maps N [--level L] [--seed S] [--gen-out FILE.csv]
+    // battlecity_bench --bench [name_filter]   (chỉ có khi biên dịch với -DBATTLECITY_BENCHMARKS)
+    // battlecity_bench --alloc-guard [ticks]   (như trên; thoát 1 nếu tick giữa màn có cấp phát)
+    bool headlessMode = false, vsync = true; BatchOptions batch; MapGenOptions mapGen;
+    const char* recordPath = nullptr; const char* replayPath = nullptr;
+    bool serverMode = false; int netSelfTestLevel = 0; NetServerOptions server; NetClientOptions client; string connectTarget;
+    HostOptions host; EnvBenchOptions envBench;
+    batch.aiThreads = min(3, max(0, (int)std::thread::hardware_concurrency() - 1));
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = (i + 1 < argc);
+        if (strcmp(argv[i], "--pack-assets") == 0) return packAssetBundle(hasValue ? argv[i + 1] : ASSET_BUNDLE_PATH);
+#if defined(BATTLECITY_BENCHMARKS)
+        else if (strcmp(argv[i], "--bench") == 0) return runBenchmarks(hasValue ? argv[i + 1] : nullptr);
+        else if (strcmp(argv[i], "--alloc-guard") == 0) return runAllocGuard(hasValue ? (Uint32)max(1, atoi(argv[i + 1])) : 20000);
+#endif
+        else if (strcmp(argv[i], "--headless") == 0) headlessMode = true;
+        else if (strcmp(argv[i], "--no-vsync") == 0) vsync = false;
+        else if (strcmp(argv[i], "--matches") == 0 && hasValue) batch.matches = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--players") == 0 && hasValue) batch.players = (atoi(argv[++i]) == 2) ? 2 : 1;
+        else if (strcmp(argv[i], "--level") == 0 && hasValue) batch.startLevel = mapGen.level = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--max-ticks") == 0 && hasValue) batch.maxTicksPerMatch = (Uint32)max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--trace") == 0 && hasValue) batch.tracePath = argv[++i];
+        else if (strcmp(argv[i], "--log-level") == 0 && hasValue) {
+            const char* name = argv[++i];
+            for (int level = 0; level <= (int)LogLevel::OFF; ++level) {
+                const char* levelName = (level < (int)LogLevel::OFF) ? LOG_LEVEL_NAMES[level] : "OFF";
+                if (SDL_strcasecmp(name, levelName) == 0) AsyncLogger::instance().minLevel = level;
+            }
+        }
+        else if (strcmp(argv[i], "--ai-threads") == 0 && hasValue) batch.aiThreads = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue) batch.seed = mapGen.firstSeed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--map-seed") == 0 && hasValue) batch.mapSeed = (Uint32)strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--gen-maps") == 0 && hasValue) mapGen.count = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--gen-out") == 0 && hasValue) mapGen.csvPath = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && hasValue) recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && hasValue) replayPath = argv[++i];
+        else if (strcmp(argv[i], "--host") == 0 && hasValue) host.matches = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--host-threads") == 0 && hasValue) host.threads = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--host-out") == 0 && hasValue) host.csvPath = argv[++i];
+        else if (strcmp(argv[i], "--env-bench") == 0 && hasValue) envBench.worlds = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--env-steps") == 0 && hasValue) envBench.steps = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--frame-skip") == 0 && hasValue) envBench.frameSkip = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--server") == 0) serverMode = true;
+        else if (strcmp(argv[i], "--net-selftest") == 0) netSelfTestLevel = (hasValue && isdigit((unsigned char)argv[i + 1][0])) ? max(1, atoi(argv[++i])) : 20;
+        else if (strcmp(argv[i], "--connect") == 0 && hasValue) connectTarget = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && hasValue) server.port = client.port = (Uint16)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && hasValue) client.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--net-latency") == 0 && hasValue) server.conditions.latencyMs = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--net-jitter") == 0 && hasValue) server.conditions.jitterMs = max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--net-loss") == 0 && hasValue) server.conditions.lossPercent = min(100, max(0, atoi(argv[++i])));
+    }
+    if (netSelfTestLevel > 0) return runNetSelfTest(netSelfTestLevel, server.conditions);
+    if (serverMode) {
+        server.players = batch.players; server.startLevel = batch.startLevel; server.seed = batch.seed; server.mapSeed = batch.mapSeed;
+        return runNetServer(server);
+    }
+    if (!connectTarget.empty()) {
+        size_t colon = connectTarget.rfind(':');
+        if (colon != string::npos) { client.port = (Uint16)atoi(connectTarget.c_str() + colon + 1); connectTarget.resize(colon); }
+        client.host = connectTarget.c_str(); client.headless = headlessMode; client.vsync = vsync;
+        client.seed = batch.seed; client.conditions = server.conditions;
+        return runNetClient(client);
+    }
+    if (replayPath) return runReplay(replayPath, batch.tracePath);
+    if (mapGen.count > 0) return runMapGeneration(mapGen);
+    if (envBench.worlds > 0) {
+        envBench.threads = batch.aiThreads; envBench.players = batch.players; envBench.seed = batch.seed ? batch.seed : 1;
+        return runEnvBenchmark(envBench);
+    }
+    if (host.matches > 0) {
+        host.players = batch.players; host.startLevel = batch.startLevel; host.maxTicksPerMatch = batch.maxTicksPerMatch;
+        host.seed = batch.seed ? batch.seed : 1; host.mapSeed = batch.mapSeed;
+        return runMatchHost(host);
+    }
+    if (headlessMode) return runHeadlessBatch(batch);
+
     {
-        Game game;
+        Game game(false, vsync, batch.aiThreads);
+        game.fixedMapSeed = batch.mapSeed; game.recordPath = recordPath;
+        if (batch.seed) game.rng.seed(batch.seed);
         if (game.running) {
             game.run();
         } else {
-            cerr << "Game initialization failed. Exiting." << endl;
+            LOG_ERROR("Game initialization failed. Exiting.");
         }
         // Destructor của game sẽ tự động chạy ở đây khi ra khỏi scope
     }
-    cout << "Application finished." << endl;
+    LOG_INFO("Application finished.");
     return 0;
 }
-
-// =============================================================================
-// == Định Nghĩa Hàm Tiện Ích ==
-// =============================================================================
-SDL_Texture* loadTexture(const std::string &path, SDL_Renderer* renderer) {
-    SDL_Texture* newTexture = nullptr;
-    SDL_Surface* loadedSurface = IMG_Load(path.c_str());
-    if (!loadedSurface) {
-        cerr << "Unable to load image " << path << "! SDL_image Error: " << IMG_GetError() << endl;
-    } else {
-        newTexture = SDL_CreateTextureFromSurface(renderer, loadedSurface);
-        if (!newTexture) {
-            cerr << "Unable to create texture from " << path << "! SDL Error: " << SDL_GetError() << endl;
-        }
-        SDL_FreeSurface(loadedSurface);
-    }
-    return newTexture;
-}